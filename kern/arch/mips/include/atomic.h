@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _MIPS_ATOMIC_H_
+#define _MIPS_ATOMIC_H_
+
+/*
+ * MIPS atomic operations, using LL/SC. Each read-modify-write is one
+ * LL/SC pair with nothing else between that touches memory; if the
+ * SC fails (someone else wrote the word, or we took an interrupt) we
+ * go around again.
+ */
+
+void atomic_init(struct atomic *a, int val);
+int atomic_get(const struct atomic *a);
+void atomic_set(struct atomic *a, int val);
+int atomic_add(struct atomic *a, int delta);
+int atomic_cas(struct atomic *a, int old, int new);
+int atomic_swap(struct atomic *a, int new);
+int atomic_fetch_or(struct atomic *a, int bits);
+void membar_sync(void);
+
+////////////////////////////////////////////////////////////
+
+ATOMIC_INLINE
+void
+atomic_init(struct atomic *a, int val)
+{
+	a->a_val = val;
+}
+
+ATOMIC_INLINE
+int
+atomic_get(const struct atomic *a)
+{
+	return a->a_val;
+}
+
+ATOMIC_INLINE
+void
+atomic_set(struct atomic *a, int val)
+{
+	a->a_val = val;
+}
+
+ATOMIC_INLINE
+int
+atomic_add(struct atomic *a, int delta)
+{
+	int x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = a->a_val */
+			"addu %1, %0, %3;"	/*   y = x + delta */
+			"sc %1, 0(%2);"		/*   a->a_val = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (&a->a_val), "r" (delta)
+			: "memory");
+	} while (y == 0);
+	return x + delta;
+}
+
+ATOMIC_INLINE
+int
+atomic_cas(struct atomic *a, int old, int new)
+{
+	int x, y;
+
+	/*
+	 * If the loaded value doesn't match, skip the SC and leave
+	 * Y at 1 so we return the mismatch instead of retrying.
+	 * noreorder so the assembler can't hoist the move into the
+	 * branch delay slot.
+	 */
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			".set noreorder;"	/* we fill the delay slot */
+			"li %1, 1;"		/*   y = 1 */
+			"ll %0, 0(%2);"		/*   x = a->a_val */
+			"bne %0, %3, 1f;"	/*   if (x != old) goto 1 */
+			"nop;"			/*   (delay slot) */
+			"move %1, %4;"		/*   y = new */
+			"sc %1, 0(%2);"		/*   a->a_val = y; y = success? */
+			"1:"
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (&a->a_val), "r" (old), "r" (new)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+int
+atomic_swap(struct atomic *a, int new)
+{
+	int x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = a->a_val */
+			"move %1, %3;"		/*   y = new */
+			"sc %1, 0(%2);"		/*   a->a_val = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (&a->a_val), "r" (new)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+int
+atomic_fetch_or(struct atomic *a, int bits)
+{
+	int x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = a->a_val */
+			"or %1, %0, %3;"	/*   y = x | bits */
+			"sc %1, 0(%2);"		/*   a->a_val = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (&a->a_val), "r" (bits)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+/*
+ * Full memory barrier: all loads and stores before it complete before
+ * any after it.
+ */
+ATOMIC_INLINE
+void
+membar_sync(void)
+{
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		"sync;"			/* do it */
+		".set pop"		/* restore assembler mode */
+		::: "memory");
+}
+
+
+#endif /* _MIPS_ATOMIC_H_ */
@@ -36,6 +36,7 @@
 #include <spl.h>
 #include <thread.h>
 #include <current.h>
+#include <proc.h>
 #include <vm.h>
 #include <mainbus.h>
 #include <syscall.h>
@@ -155,6 +156,8 @@ mips_trap(struct trapframe *tf)
 
 		old_in = curthread->t_in_interrupt;
 		curthread->t_in_interrupt = 1;
+		/* for hardclock's user/system time split */
+		curthread->t_intr_fromuser = !iskern;
 
 		/*
 		 * The processor has turned interrupts off; if the
@@ -194,6 +197,14 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+#if OPT_A2
+		if (!iskern && curproc->p_exiting) {
+			/* sync up interrupts as below, and leave at done */
+			spl = splhigh();
+			splx(spl);
+			goto done;
+		}
+#endif
 		goto done2;
 	}
 
@@ -315,6 +326,12 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+#if OPT_A2
+	if (!iskern) {
+		/* if another thread of ours called _exit, don't go back */
+		uthread_checkexit();
+	}
+#endif
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -34,7 +34,9 @@
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
+#include <clock.h>
 #include <syscall.h>
+#include <syscallstats.h>
 
 
 /*
@@ -74,13 +76,216 @@
  * values) further arguments must be fetched from the user-level
  * stack, starting at sp+16 to skip over the slots for the
  * registerized values, with copyin().
+ *
+ * syscall() looks the call number up in syscalltab, below. Each entry
+ * names the call and has a function that takes its arguments out of
+ * the trapframe and calls the handler. With the syscallstats option,
+ * each call is counted and timed; see syscallstats.h.
+ */
+/*
+ * Argument marshalling: one function per system call, which takes the
+ * arguments out of the trapframe and calls the handler. Each returns
+ * an error code, leaving the return value (if any) in *retval.
  */
+
+static
+int
+sc_reboot(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_reboot(tf->tf_a0);
+}
+
+static
+int
+sc___time(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys___time((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+#ifdef UW
+static
+int
+sc_write(struct trapframe *tf, int32_t *retval)
+{
+	return sys_write((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			 (int)tf->tf_a2, (int *)retval);
+}
+
+static
+int
+sc__exit(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	sys__exit((int)tf->tf_a0);
+	/* sys__exit does not return, execution should not get here */
+	panic("unexpected return from sys__exit");
+	return 0;
+}
+
+static
+int
+sc_getpid(struct trapframe *tf, int32_t *retval)
+{
+	(void)tf;
+	return sys_getpid((pid_t *)retval);
+}
+
+static
+int
+sc_waitpid(struct trapframe *tf, int32_t *retval)
+{
+	return sys_waitpid((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+			   (int)tf->tf_a2, (pid_t *)retval);
+}
+
+static
+int
+sc_wait4(struct trapframe *tf, int32_t *retval)
+{
+	return sys_wait4((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+			 (int)tf->tf_a2, (userptr_t)tf->tf_a3, (pid_t *)retval);
+}
+
+static
+int
+sc_getrusage(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_getrusage((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_sysring_enter(struct trapframe *tf, int32_t *retval)
+{
+	return sys_sysring_enter((userptr_t)tf->tf_a0, (unsigned)tf->tf_a1,
+				 retval);
+}
+#endif // UW
+
+static
+int
+sc_fork(struct trapframe *tf, int32_t *retval)
+{
+	return sys_fork(tf, (pid_t *)retval);
+}
+
+static
+int
+sc_execv(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_vfork(struct trapframe *tf, int32_t *retval)
+{
+	return sys_vfork(tf, (pid_t *)retval);
+}
+
+static
+int
+sc___spawn(struct trapframe *tf, int32_t *retval)
+{
+	return sys___spawn((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+			   (pid_t *)retval);
+}
+
+static
+int
+sc___thread_create(struct trapframe *tf, int32_t *retval)
+{
+	return sys___thread_create((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+				   (userptr_t)tf->tf_a2, retval);
+}
+
+static
+int
+sc_thread_exit(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	sys_thread_exit((userptr_t)tf->tf_a0);
+	panic("unexpected return from sys_thread_exit");
+	return 0;
+}
+
+static
+int
+sc_thread_join(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_thread_join((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_futex_wait(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_futex_wait((userptr_t)tf->tf_a0, (int)tf->tf_a1);
+}
+
+static
+int
+sc_futex_wake(struct trapframe *tf, int32_t *retval)
+{
+	return sys_futex_wake((userptr_t)tf->tf_a0, (int)tf->tf_a1, retval);
+}
+
+/*
+ * The system call table, indexed by call number. Empty slots are
+ * calls we don't have.
+ */
+static const struct {
+	const char *sc_name;
+	int (*sc_func)(struct trapframe *tf, int32_t *retval);
+} syscalltab[SYSCALL_NCALLS] = {
+#define SC(name) [SYS_##name] = { #name, sc_##name }
+	SC(reboot),
+	SC(__time),
+#ifdef UW
+	SC(write),
+	SC(_exit),
+	SC(getpid),
+	SC(waitpid),
+	SC(wait4),
+	SC(getrusage),
+	SC(sysring_enter),
+#endif // UW
+	SC(fork),
+	SC(execv),
+	SC(vfork),
+	SC(__spawn),
+	SC(__thread_create),
+	SC(thread_exit),
+	SC(thread_join),
+	SC(futex_wait),
+	SC(futex_wake),
+#undef SC
+};
+
+const char *
+syscall_name(int callno)
+{
+	if (callno < 0 || callno >= SYSCALL_NCALLS) {
+		return NULL;
+	}
+	return syscalltab[callno].sc_name;
+}
+
 void
 syscall(struct trapframe *tf)
 {
 	int callno;
 	int32_t retval;
 	int err;
+#if OPT_SYSCALLSTATS
+	uint64_t start;
+#endif
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -99,49 +304,20 @@ syscall(struct trapframe *tf)
 
 	retval = 0;
 
-	switch (callno) {
-	    case SYS_reboot:
-		err = sys_reboot(tf->tf_a0);
-		break;
-
-	    case SYS___time:
-		err = sys___time((userptr_t)tf->tf_a0,
-				 (userptr_t)tf->tf_a1);
-		break;
-#ifdef UW
-	case SYS_write:
-	  err = sys_write((int)tf->tf_a0,
-			  (userptr_t)tf->tf_a1,
-			  (int)tf->tf_a2,
-			  (int *)(&retval));
-	  break;
-	case SYS__exit:
-	  sys__exit((int)tf->tf_a0);
-	  /* sys__exit does not return, execution should not get here */
-	  panic("unexpected return from sys__exit");
-	  break;
-	case SYS_getpid:
-	  err = sys_getpid((pid_t *)&retval);
-	  break;
-	case SYS_waitpid:
-	  err = sys_waitpid((pid_t)tf->tf_a0,
-			    (userptr_t)tf->tf_a1,
-			    (int)tf->tf_a2,
-			    (pid_t *)&retval);
-	  break;
-#endif // UW
-
-	    /* Add stuff here */
-  case SYS_fork:
-    err = sys_fork(tf, (pid_t *)&retval);
-    break;
-  case SYS_execv:
-    err = sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
-    break;
-	default:
-	  kprintf("Unknown syscall %d\n", callno);
-	  err = ENOSYS;
-	  break;
+	if (callno >= 0 && callno < SYSCALL_NCALLS &&
+	    syscalltab[callno].sc_func != NULL) {
+#if OPT_SYSCALLSTATS
+		syscallstats_enter(callno);
+		start = gettime_ns();
+#endif
+		err = syscalltab[callno].sc_func(tf, &retval);
+#if OPT_SYSCALLSTATS
+		syscallstats_exit(callno, gettime_ns() - start);
+#endif
+	}
+	else {
+		kprintf("Unknown syscall %d\n", callno);
+		err = ENOSYS;
 	}
 
 
@@ -31,7 +31,8 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <spl.h>
-#include <spinlock.h>
+#include <cpu.h>
+#include <ticketlock.h>
 #include <proc.h>
 #include <current.h>
 #include <mips/tlb.h>
@@ -46,10 +47,20 @@
 /* under dumbvm, always have 48k of user stack */
 #define DUMBVM_STACKPAGES    12
 
+/*
+ * Extra user threads get 16k stacks each, stacked downwards below the
+ * main stack with an unmapped guard page under each one.
+ */
+#define DUMBVM_TSTACKPAGES   4
+#define DUMBVM_TSTACKSTRIDE  ((DUMBVM_TSTACKPAGES + 1) * PAGE_SIZE)
+#define DUMBVM_TSTACKTOP(slot) \
+	(USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE - \
+	 (slot) * DUMBVM_TSTACKSTRIDE)
+
 /*
  * Wrap rma_stealmem in a spinlock.
  */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+static struct ticketlock stealmem_lock = TICKETLOCK_INITIALIZER("stealmem");
 
 int *coremap_count;
 paddr_t *coremap_location;
@@ -62,7 +73,7 @@ void
 vm_bootstrap(void)
 {
   KASSERT(!bootstrapped);
-  spinlock_acquire(&stealmem_lock);
+  ticketlock_acquire(&stealmem_lock);
 
   ram_getsize(&firstpaddr, &lastpaddr);
   num_pages = (lastpaddr - firstpaddr) / PAGE_SIZE;
@@ -91,7 +102,7 @@ vm_bootstrap(void)
 
   bootstrapped = true;
 
-  spinlock_release(&stealmem_lock);
+  ticketlock_release(&stealmem_lock);
 }
 
 static
@@ -101,16 +112,16 @@ getppages(int npages)
   if (!bootstrapped) {
     paddr_t addr;
 
-    spinlock_acquire(&stealmem_lock);
+    ticketlock_acquire(&stealmem_lock);
 
     addr = ram_stealmem(npages);
 
-    spinlock_release(&stealmem_lock);
+    ticketlock_release(&stealmem_lock);
 
     return addr;
   }
 
-  spinlock_acquire(&stealmem_lock);
+  ticketlock_acquire(&stealmem_lock);
 
   paddr_t addr;
   int page = 0;
@@ -129,7 +140,7 @@ getppages(int npages)
   addr = coremap_location[page];
 
   //kprintf("allocating %d pages at page %d, with address 0x%x\n", npages, page, addr);
-	spinlock_release(&stealmem_lock);
+	ticketlock_release(&stealmem_lock);
 
   return addr;
 }
@@ -152,7 +163,7 @@ free_kpages(vaddr_t addr)
 {
   //kprintf("attempting to free page at address 0x%x\n", addr);
 
-  spinlock_acquire(&stealmem_lock);
+  ticketlock_acquire(&stealmem_lock);
 
   int page = 0;
   int npages = 0;
@@ -170,20 +181,70 @@ free_kpages(vaddr_t addr)
     coremap_count[i] = 0;
   }
 
-	spinlock_release(&stealmem_lock);
+	ticketlock_release(&stealmem_lock);
 }
 
+/*
+ * The only shootdowns are for freed thread stacks (see
+ * as_free_threadstack). A cpu's TLB only holds pages of the address
+ * space it last activated, so we don't bother checking ts_addrspace;
+ * dropping some other space's entry for the same page does no harm.
+ */
 void
 vm_tlbshootdown_all(void)
 {
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	int i, spl;
+
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
 }
 
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	int i, spl;
+
+	spl = splhigh();
+	i = tlb_probe(ts->ts_vaddr & TLBHI_VPAGE, 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
+}
+
+/*
+ * Physical address of the thread stack page holding VADDR, or 0 if
+ * it isn't in one.
+ */
+static
+paddr_t
+as_tstack_lookup(struct addrspace *as, vaddr_t vaddr)
+{
+	vaddr_t top;
+	int slot;
+	paddr_t paddr = 0;
+
+	top = DUMBVM_TSTACKTOP(0);
+	if (vaddr >= top ||
+	    vaddr < DUMBVM_TSTACKTOP(AS_MAXTHREADSTACKS)) {
+		return 0;
+	}
+	slot = (top - 1 - vaddr) / DUMBVM_TSTACKSTRIDE;
+	if (vaddr < DUMBVM_TSTACKTOP(slot) - DUMBVM_TSTACKPAGES * PAGE_SIZE) {
+		/* guard page */
+		return 0;
+	}
+
+	spinlock_acquire(&as->as_tstacklock);
+	if (as->as_tstacks[slot] != NULL) {
+		paddr = as->as_tstacks[slot][(DUMBVM_TSTACKTOP(slot) - 1 -
+					      vaddr) / PAGE_SIZE];
+	}
+	spinlock_release(&as->as_tstacklock);
+	return paddr;
 }
 
 int
@@ -213,6 +274,9 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return EINVAL;
 	}
 
+	/* every fault here is a TLB miss; pages are never paged out */
+	curthread->t_usage.tu_faults++;
+
 	if (curproc == NULL) {
 		/*
 		 * No process. This is probably a kernel fault early
@@ -268,6 +332,9 @@ vm_fault(int faulttype, vaddr_t faultaddress)
     int offset = (faultaddress - stackbase) % PAGE_SIZE;
 		paddr = as->page_table3[page] + offset;
 	}
+	else if ((paddr = as_tstack_lookup(as, faultaddress)) != 0) {
+		/* one of the extra thread stacks */
+	}
 	else {
 		return EFAULT;
 	}
@@ -321,10 +388,43 @@ as_create(void)
   as->page_table1 = NULL;
   as->page_table2 = NULL;
   as->page_table3 = NULL;
+  spinlock_init(&as->as_tstacklock);
+  for (int i = 0; i < AS_MAXTHREADSTACKS; i++) {
+    as->as_tstacks[i] = NULL;
+  }
 
 	return as;
 }
 
+/*
+ * Empty a thread stack slot and return its pages, so that faults no
+ * longer find them.
+ */
+static
+int *
+as_tstack_take(struct addrspace *as, int slot)
+{
+  int *pages;
+
+  spinlock_acquire(&as->as_tstacklock);
+  pages = as->as_tstacks[slot];
+  as->as_tstacks[slot] = NULL;
+  spinlock_release(&as->as_tstacklock);
+
+  KASSERT(pages != NULL);
+  return pages;
+}
+
+static
+void
+as_tstack_freepages(int *pages)
+{
+  for (int i = 0; i < DUMBVM_TSTACKPAGES; i++) {
+    free_kpages(PADDR_TO_KVADDR(pages[i]));
+  }
+  kfree(pages);
+}
+
 void
 as_destroy(struct addrspace *as)
 {
@@ -337,6 +437,13 @@ as_destroy(struct addrspace *as)
   for (int i = 0; i < DUMBVM_STACKPAGES; i++) {
     free_kpages(PADDR_TO_KVADDR(as->page_table3[i]));
   }
+  /* nothing runs in AS any more, so no TLB shootdown is needed */
+  for (int i = 0; i < AS_MAXTHREADSTACKS; i++) {
+    if (as->as_tstacks[i] != NULL) {
+      as_tstack_freepages(as_tstack_take(as, i));
+    }
+  }
+  spinlock_cleanup(&as->as_tstacklock);
   kfree(as->page_table1);
   kfree(as->page_table2);
   kfree(as->page_table3);
@@ -480,6 +587,90 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Allocate the pages for a thread stack and put them in a free slot,
+ * or in slot WANT if that's not -1.
+ */
+static
+int
+as_tstack_alloc(struct addrspace *as, int want, int *slotp)
+{
+  int *pages;
+  int i, slot;
+
+  pages = kmalloc(DUMBVM_TSTACKPAGES * sizeof(int));
+  if (pages == NULL) {
+    return ENOMEM;
+  }
+  for (i = 0; i < DUMBVM_TSTACKPAGES; i++) {
+    pages[i] = getppages(1);
+    if (pages[i] == 0) {
+      while (--i >= 0) {
+        free_kpages(PADDR_TO_KVADDR(pages[i]));
+      }
+      kfree(pages);
+      return ENOMEM;
+    }
+    as_zero_region(pages[i], 1);
+  }
+
+  spinlock_acquire(&as->as_tstacklock);
+  for (slot = 0; slot < AS_MAXTHREADSTACKS; slot++) {
+    if (as->as_tstacks[slot] == NULL && (want < 0 || want == slot)) {
+      as->as_tstacks[slot] = pages;
+      break;
+    }
+  }
+  spinlock_release(&as->as_tstacklock);
+
+  if (slot == AS_MAXTHREADSTACKS) {
+    for (i = 0; i < DUMBVM_TSTACKPAGES; i++) {
+      free_kpages(PADDR_TO_KVADDR(pages[i]));
+    }
+    kfree(pages);
+    return ENOMEM;
+  }
+  *slotp = slot;
+  return 0;
+}
+
+int
+as_define_threadstack(struct addrspace *as, int *slot, vaddr_t *stackptr)
+{
+  int result;
+
+  result = as_tstack_alloc(as, -1, slot);
+  if (result) {
+    return result;
+  }
+  *stackptr = DUMBVM_TSTACKTOP(*slot);
+  return 0;
+}
+
+void
+as_free_threadstack(struct addrspace *as, int slot)
+{
+  struct tlbshootdown ts[DUMBVM_TSTACKPAGES];
+  int *pages;
+  int i;
+
+  KASSERT(slot >= 0 && slot < AS_MAXTHREADSTACKS);
+
+  /*
+   * Other threads of the process may be running on other cpus, and
+   * their TLBs may still map the stack (if, say, one was handed a
+   * pointer into it). Clear the slot first so that no fault can map
+   * it again, then make every cpu forget it before the pages go.
+   */
+  pages = as_tstack_take(as, slot);
+  for (i = 0; i < DUMBVM_TSTACKPAGES; i++) {
+    ts[i].ts_addrspace = as;
+    ts[i].ts_vaddr = DUMBVM_TSTACKTOP(slot) - (i + 1) * PAGE_SIZE;
+  }
+  ipi_tlbshootdown_all(ts, DUMBVM_TSTACKPAGES);
+  as_tstack_freepages(pages);
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -531,6 +722,40 @@ as_copy(struct addrspace *old, struct addrspace **ret)
       PAGE_SIZE);
   }
 
+  /*
+   * The forking thread may be running on one of the thread stacks,
+   * so take them all. Another thread may exit and free its stack
+   * (and the array of its frames) while we copy, so take a copy of
+   * the frame addresses under the lock; the frames themselves stay
+   * RAM, and if they've been freed we copy junk nobody will use.
+   */
+  for (int slot = 0; slot < AS_MAXTHREADSTACKS; slot++) {
+    paddr_t oldpages[DUMBVM_TSTACKPAGES];
+    bool used;
+    int got;
+
+    spinlock_acquire(&old->as_tstacklock);
+    used = (old->as_tstacks[slot] != NULL);
+    if (used) {
+      for (int i = 0; i < DUMBVM_TSTACKPAGES; i++) {
+        oldpages[i] = old->as_tstacks[slot][i];
+      }
+    }
+    spinlock_release(&old->as_tstacklock);
+    if (!used) {
+      continue;
+    }
+    if (as_tstack_alloc(new, slot, &got)) {
+      as_destroy(new);
+      return ENOMEM;
+    }
+    for (int i = 0; i < DUMBVM_TSTACKPAGES; i++) {
+      memmove((void *)PADDR_TO_KVADDR(new->as_tstacks[slot][i]),
+        (const void *)PADDR_TO_KVADDR(oldpages[i]),
+        PAGE_SIZE);
+    }
+  }
+
 	*ret = new;
 	return 0;
 }
@@ -73,6 +73,19 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * MI interface to the on-chip timer. The interrupt handler below
+ * always rearms it for one hardclock period.
+ */
+void
+mainbus_timer_set(unsigned hardclocks)
+{
+	KASSERT(hardclocks > 0);
+	KASSERT(hardclocks <= 0xffffffffU / (CPU_FREQUENCY / HZ));
+
+	mips_timer_set(hardclocks * (CPU_FREQUENCY / HZ));
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -38,6 +38,8 @@
  * of the available clocks to use, if more than one is available.
  *
  * The system will panic if gettime() is called and there is no clock.
+ * gettime_ns() instead returns 0, so it can be used for statistics
+ * from code that may run before the clock is attached.
  */
 
 #include <types.h>
@@ -68,3 +70,16 @@ gettime(time_t *secs, uint32_t *nsecs)
 	KASSERT(the_clock!=NULL);
 	the_clock->rtc_gettime(the_clock->rtc_devdata, secs, nsecs);
 }
+
+uint64_t
+gettime_ns(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	if (the_clock == NULL) {
+		return 0;
+	}
+	the_clock->rtc_gettime(the_clock->rtc_devdata, &secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
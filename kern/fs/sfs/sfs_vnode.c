@@ -900,11 +900,11 @@ sfs_reclaim(struct vnode *v)
 	 * decision was made to reclaim it. (You must also synchronize
 	 * this with sfs_loadvnode.)
 	 */
-	if (v->vn_refcount != 1) {
+	if (atomic_get(&v->vn_refcount) != 1) {
 
 		/* consume the reference VOP_DECREF gave us */
-		KASSERT(v->vn_refcount>1);
-		v->vn_refcount--;
+		KASSERT(atomic_get(&v->vn_refcount)>1);
+		atomic_add(&v->vn_refcount, -1);
 
 		vfs_biglock_release();
 		return EBUSY;
@@ -36,9 +36,13 @@
 
 
 #include <vm.h>
+#include <spinlock.h>
 
 struct vnode;
 
+/* Most extra user stacks (for threads beyond the first) per process */
+#define AS_MAXTHREADSTACKS 16
+
 
 /* 
  * Address space - data structure associated with the virtual memory
@@ -56,6 +60,10 @@ struct addrspace {
   int *page_table1;
   int *page_table2;
   int *page_table3;
+
+  /* extra thread stacks below the main one; NULL if slot unused */
+  struct spinlock as_tstacklock;
+  int *as_tstacks[AS_MAXTHREADSTACKS];
 };
 
 /*
@@ -92,6 +100,12 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_define_threadstack - set up another stack, for a new user
+ *                thread. Hands back its slot number and initial stack
+ *                pointer.
+ *
+ *    as_free_threadstack - release a stack from as_define_threadstack.
  */
 
 struct addrspace *as_create(void);
@@ -108,6 +122,9 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_define_threadstack(struct addrspace *as, int *slot,
+                                        vaddr_t *initstackptr);
+void              as_free_threadstack(struct addrspace *as, int slot);
 
 
 /*
@@ -115,9 +132,13 @@ int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
  *    load_elf - load an ELF user program executable into the current
  *               address space. Returns the entry point (initial PC)
  *               in the space pointed to by ENTRYPOINT.
+ *    elfcache_flush - forget all cached executable headers.
+ *    elfcache_printstats - print executable header cache stats.
  */
 
 int load_elf(struct vnode *v, vaddr_t *entrypoint);
+void elfcache_flush(void);
+void elfcache_printstats(void);
 
 
 #endif /* _ADDRSPACE_H_ */
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _ARGBUF_H_
+#define _ARGBUF_H_
+
+/*
+ * Program arguments on their way from one user address space to
+ * another (execv, spawn).
+ *
+ * argbuf_copyin copies the strings of a user argv, one after another,
+ * into a single ARG_MAX-byte buffer. The space their argv pointers
+ * will take on the new stack is counted against ARG_MAX as it goes,
+ * so an oversize argument list fails with E2BIG as soon as it gets
+ * too big. argbuf_copyout lays out the argv array and the strings in
+ * the same buffer as they will sit at the top of the new stack, and
+ * copies the lot out at once; the argbuf can't be copied out again
+ * after that. argbuf_cleanup frees the buffer. argbuf_fromkernel is
+ * argbuf_copyin for arguments already in the kernel (runprogram).
+ */
+
+struct argbuf {
+	char *ab_buf;
+	size_t ab_len;		/* bytes of strings, with their NULs */
+	int ab_nargs;
+};
+
+int argbuf_copyin(struct argbuf *ab, userptr_t uargv);
+int argbuf_fromkernel(struct argbuf *ab, char **args, int nargs);
+int argbuf_copyout(struct argbuf *ab, vaddr_t *stackptr, userptr_t *uargv);
+void argbuf_cleanup(struct argbuf *ab);
+
+#endif /* _ARGBUF_H_ */
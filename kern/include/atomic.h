@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic operations on single words of memory, for counters and flags
+ * that don't need a lock around them.
+ *
+ * struct atomic wraps the word so it can't be accessed by accident
+ * with ordinary loads and stores. The guts are machine-dependent.
+ *
+ * atomic_init	Set the initial value. Not atomic; for setup only.
+ * atomic_get	Read the value.
+ * atomic_set	Write the value.
+ * atomic_add	Add DELTA (may be negative); returns the *new* value.
+ * atomic_cas	If the value is OLD, replace it with NEW. Returns what
+ *		the value was, so the swap happened iff that equals OLD.
+ * atomic_swap	Replace the value with NEW; returns the old value.
+ * atomic_fetch_or
+ *		OR BITS into the value; returns the old value.
+ *
+ * None of these is a memory barrier. Use membar_sync() where ordering
+ * against other memory accesses matters.
+ */
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+struct atomic {
+	volatile int a_val;
+};
+
+#define ATOMIC_INITIALIZER(val)	{ (val) }
+
+/* Get the machine-dependent bits. */
+#include <machine/atomic.h>
+
+
+#endif /* _ATOMIC_H_ */
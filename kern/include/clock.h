@@ -38,8 +38,8 @@
  * hardclock() is called on every CPU HZ times a second, possibly only
  * when the CPU is not idle, for scheduling.
  *
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timerclock() is called on one CPU once every LT_GRANULARITY usec
+ * (a "timer tick") to run expired callouts.
  *
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
@@ -63,6 +63,32 @@ void timerclock(void);
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
 
+/* The same as a single count of nanoseconds; 0 if there's no clock yet. */
+uint64_t gettime_ns(void);
+
+/*
+ * Callouts: call co_func(co_arg) from the timer interrupt once a given
+ * number of timer ticks have passed. The struct is owned by the
+ * caller and must stay valid while pending; the fields are private to
+ * clock.c.
+ *
+ * callout_init prepares a callout. callout_schedule (re)arms it to
+ * fire TICKS timer ticks from now. callout_stop disarms it, returning
+ * true if it had not yet fired. The function runs in interrupt
+ * context and so must not sleep.
+ */
+struct callout {
+	struct callout *co_next;	/* in wheel bucket */
+	struct callout **co_prevp;	/* NULL if not pending */
+	unsigned co_expire;		/* timer tick to fire on */
+	void (*co_func)(void *);
+	void *co_arg;
+};
+
+void callout_init(struct callout *co, void (*func)(void *), void *arg);
+void callout_schedule(struct callout *co, unsigned ticks);
+bool callout_stop(struct callout *co);
+
 void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
                  time_t *rsecs, uint32_t *rnsecs);
@@ -71,7 +97,7 @@ void getinterval(time_t secs1, uint32_t nsecs,
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
  *
- *  this will be more efficient than clocknap() for longer sleeps
+ * It is clocknap() with the seconds converted to timer ticks.
  */
 void clocksleep(int seconds);
 
@@ -32,6 +32,7 @@
 
 
 #include <spinlock.h>
+#include <ticketlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
@@ -60,6 +61,15 @@ struct cpu {
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_lastboost;		/* c_hardclocks at last MLFQ boost */
+
+	/*
+	 * Accessed only by this cpu, with interrupts off.
+	 * Exited threads (with their stacks) kept for thread_fork.
+	 */
+	struct threadlist c_threadcache;
+	unsigned c_threadcache_hits;	/* thread_fork reused a thread */
+	unsigned c_threadcache_misses;	/* thread_fork had to allocate */
 
 	/*
 	 * Accessed by other cpus.
@@ -67,7 +77,15 @@ struct cpu {
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
-	struct spinlock c_runqueue_lock;
+	struct ticketlock c_runqueue_lock;
+	unsigned c_stolen;		/* Threads taken by idle cpus */
+
+	/*
+	 * Accessed only by this cpu, with interrupts off.
+	 */
+	unsigned c_steals;		/* Threads this cpu took from others */
+	bool c_tickless;		/* Timer stretched out while idle */
+	unsigned c_stealmisses;		/* Steal attempts that found nothing */
 
 	/*
 	 * Accessed by other cpus.
@@ -152,6 +170,7 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_all does a shootdown on every CPU and waits for it.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -166,6 +185,7 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_all(const struct tlbshootdown *mappings, unsigned n);
 
 void interprocessor_interrupt(void);
 
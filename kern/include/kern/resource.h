@@ -67,6 +67,9 @@ struct rusage {
 	__counter_t ru_nsignals;	/* signals delivered (count) */
 	__counter_t ru_nvcsw;		/* voluntary context switches (count)*/
 	__counter_t ru_nivcsw;		/* involuntary ditto (count) */
+	/* OS/161 extensions */
+	__counter_t ru_inbytes;		/* bytes read from files (count) */
+	__counter_t ru_outbytes;	/* bytes written to files (count) */
 };
 
 /* limit codes for getrusage/setrusage */
@@ -85,8 +85,8 @@
 #define SYS_sigreturn    32
 //#define SYS_sigaltstack 33
 //                              (resource tracking and usage)
-//#define SYS_wait4      34
-//#define SYS_getrusage  35
+#define SYS_wait4        34
+#define SYS_getrusage    35
 //                              (resource limits)
 //#define SYS_getrlimit  36
 //#define SYS_setrlimit  37
@@ -196,6 +196,13 @@
 #define SYS_sync         118
 #define SYS_reboot       119
 //#define SYS___sysctl   120
+#define SYS_futex_wait   121
+#define SYS_futex_wake   122
+#define SYS___thread_create 123
+#define SYS_thread_join  124
+#define SYS_thread_exit  125
+#define SYS___spawn      126
+#define SYS_sysring_enter 127
 
 /*CALLEND*/
 
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_SYSRING_H_
+#define _KERN_SYSRING_H_
+
+/*
+ * System call ring, for making a batch of system calls in one trap.
+ *
+ * The ring lives in user memory: a header and an array of sr_size
+ * entries, sr_size being a power of 2 no bigger than SYSRING_MAXSIZE.
+ * sr_head and sr_tail count entries forever and are taken mod sr_size
+ * to index the array. The program fills in entries at sr_head and
+ * then advances it; sysring_enter(ring, n) carries out up to n of the
+ * entries from sr_tail on, in order, writes each one's result back
+ * into its entry and advances sr_tail past them. So the entries from
+ * the old sr_tail to the new one hold results, and may be reused once
+ * those have been looked at. Only one thread should use a ring at a
+ * time.
+ *
+ * se_op is the system call number and se_arg its arguments, as they
+ * would be passed in registers. Only calls that are safe to batch are
+ * accepted; the others complete with ENOSYS. On success se_error is 0
+ * and se_result what the call returns; on failure se_error is the
+ * error code and se_result -1.
+ */
+
+#define SYSRING_MAXSIZE	1024
+
+struct sysring_entry {
+	int se_op;		/* SYS_* */
+	__u32 se_arg[3];
+	int se_result;
+	int se_error;
+};
+
+struct sysring {
+	unsigned sr_size;
+	unsigned sr_head;	/* next to submit; advanced by the program */
+	unsigned sr_tail;	/* next to run; advanced by the kernel */
+	struct sysring_entry *sr_entries;
+};
+
+#endif /* _KERN_SYSRING_H_ */
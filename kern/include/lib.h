@@ -127,6 +127,13 @@ void *kmalloc(size_t size);
 void kfree(void *ptr);
 void kheap_printstats(void);
 
+/*
+ * Per-call-site kmalloc accounting (only if the kernel is configured
+ * with "options kmallocprof"; otherwise these just say so).
+ */
+void kheap_printprofile(void);
+void kheap_resetprofile(void);
+
 /*
  * C string functions. 
  *
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention profiler.
+ *
+ * With the lockstat option, every sleep lock (struct lock) and ticket
+ * lock carries a struct lockstat that counts acquisitions and how
+ * many of them had to wait, and accumulates wait time (from asking
+ * for the lock to getting it) and hold time (from getting it to
+ * releasing it), total and maximum. Times are in nanoseconds from
+ * gettime_ns(); the LAMEbus clock behind it counts at cycle
+ * resolution.
+ *
+ * All fields are updated only by the thread (or cpu) holding the lock,
+ * so the lock itself serializes them. A lock is put on the global
+ * list the first time it is acquired.
+ *
+ * The acquire and hold counting is also what the adaptive lock
+ * statistics (lock_printstats) and ticketstats report, so a lock
+ * reads the clock once when it's acquired and once when it's
+ * released however many of them are on. Without the lockstat option
+ * only the locks those cover are counted, wait times aren't taken,
+ * and nothing goes on the global list.
+ *
+ * lockstat_print shows the TOPN locks with the most total wait time;
+ * lockstat_reset zeroes all the counters.
+ */
+
+#include "opt-lockstat.h"
+
+struct lockstat {
+	const char *ls_name;
+	struct lockstat *ls_next;	/* global list */
+	bool ls_listed;			/* on the list yet? */
+	unsigned ls_acquires;		/* total acquisitions */
+	unsigned ls_contended;		/* acquisitions that had to wait */
+	uint64_t ls_waittotal;		/* ns spent waiting, summed */
+	uint64_t ls_waitmax;		/* longest wait, ns */
+	uint64_t ls_holdtotal;		/* ns held, summed */
+	uint64_t ls_holdmax;		/* longest hold, ns */
+	uint64_t ls_holdstart;		/* time of current acquire */
+};
+
+/* Initialize; a zeroed struct lockstat is also fine. */
+void lockstat_init(struct lockstat *ls);
+
+/* Current time for WAITSTART; 0 if there's no clock yet. */
+uint64_t lockstat_now(void);
+
+/*
+ * Record an acquisition of the lock called NAME that was asked for at
+ * WAITSTART (0 to not count the wait). Call with the lock held, right
+ * after getting it.
+ */
+void lockstat_acquired(struct lockstat *ls, const char *name,
+		       uint64_t waitstart, bool contended);
+
+/* Record the end of a hold. Call with the lock held, right before
+ * releasing it. */
+void lockstat_releasing(struct lockstat *ls);
+
+/* Take a lock's stats off the list when it's destroyed. */
+void lockstat_cleanup(struct lockstat *ls);
+
+void lockstat_reset(void);
+void lockstat_print(unsigned topn);
+
+
+#endif /* _LOCKSTAT_H_ */
@@ -52,6 +52,13 @@ void mainbus_interrupt(struct trapframe *);
 /* XXX this interface is not adequately MI */
 size_t mainbus_ramsize(void);
 
+/*
+ * Make the current cpu's next timer interrupt (hardclock) come
+ * HARDCLOCKS hardclock periods from now. After that it goes back to
+ * one per period.
+ */
+void mainbus_timer_set(unsigned hardclocks);
+
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
@@ -48,18 +48,53 @@ struct semaphore;
 struct lock;
 struct cv;
 
-struct array *procTable;
 struct lock *lk;
-struct cv *cv;
+
+/*
+ * A user thread other than a process's first one, kept so it can be
+ * joined. tid 0 is the first thread, which isn't joinable.
+ */
+struct uthread {
+  int ut_tid;
+  struct thread *ut_thread;     /* NULL until it starts */
+  int ut_stackslot;             /* see as_define_threadstack */
+  vaddr_t ut_stackptr;
+  vaddr_t ut_entry;             /* where it starts in user mode... */
+  userptr_t ut_func;            /* ...with these two as arguments */
+  userptr_t ut_arg;
+  bool ut_exited;
+  userptr_t ut_retval;          /* from thread_exit */
+  struct uthread *ut_next;
+};
 
 /*
  * process structure
+ *
+ * One for each user process, from proc_create_runprogram until its
+ * parent collects its exit status, kept in a hash table indexed by
+ * pid (see pidtable_*) and on one of its parent's child lists. parent
+ * is NULL if nobody will wait for it; it then goes away when the
+ * process exits. Protected by lk.
  */
 struct process {
   pid_t pid;
   bool exited;
   int exitcode;
   struct proc *parent;
+  struct process *next;         /* pid hash chain */
+  struct process **prevp;
+  struct process *sibnext;      /* parent's p_children/p_zombies */
+  struct process **sibprevp;
+  struct threadusage usage;     /* once exited: its own and its children's */
+};
+
+/*
+ * A vfork parent waits on vw_sem, on its own stack, while the child
+ * runs in the parent's address space vw_as.
+ */
+struct vforkwait {
+  struct semaphore *vw_sem;
+  struct addrspace *vw_as;
 };
 
 /*
@@ -76,6 +111,10 @@ struct proc {
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 
+	/* Resource usage; protected by p_lock */
+	struct threadusage p_usage;	/* threads that have left */
+	struct threadusage p_childusage; /* children waited for */
+
 #ifdef UW
   /* a vnode to refer to the console device */
   /* this is a quick-and-dirty way to get console writes working */
@@ -88,6 +127,23 @@ struct proc {
 	/* add more material here as needed */
   #if OPT_A2
   pid_t pid;
+
+  /* user threads; protected by p_uthread_lock */
+  struct lock *p_uthread_lock;
+  struct cv *p_uthread_cv;      /* signalled when a thread exits */
+  struct uthread *p_uthreads;   /* threads not yet joined */
+  int p_nexttid;
+  unsigned p_nuthreads;         /* threads still running */
+  bool p_exiting;               /* _exit has been called */
+  int p_exitcode;               /* ...with this */
+
+  /* children not yet waited for; protected by lk */
+  struct process *p_children;   /* still running */
+  struct process *p_zombies;    /* exited */
+  struct cv *p_childcv;         /* signalled when a child exits */
+
+  /* set in a vforked child until it calls execv or _exit */
+  struct vforkwait *p_vfork;
   #endif /* OPT_A2 */
 };
 
@@ -114,13 +170,42 @@ int proc_addthread(struct proc *proc, struct thread *t);
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/*
+ * Resource usage of a process so far: its threads that have left and
+ * the ones still running. With CHILDREN, add in the children it has
+ * waited for.
+ */
+void proc_getusage(struct proc *proc, struct threadusage *tu, bool children);
+
 /* Fetch the address space of the current process. */
 struct addrspace *curproc_getas(void);
 
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *curproc_setas(struct addrspace *);
 
-/* Add pid to the pid queue */
-void addPid(pid_t pid);
+/*
+ * Address space reaper (proc/reaper.c): reaper_add destroys an
+ * address space that's no longer in use, in the background.
+ */
+void reaper_bootstrap(void);
+void reaper_add(struct addrspace *as);
+void reaper_printstats(void);
+
+/* Pid allocation (proc/pid.c). */
+void pid_bootstrap(void);
+int pid_alloc(pid_t *ret);
+void pid_free(pid_t pid);
+
+/*
+ * The pid table. lk must be held. pidtable_lookup returns NULL if
+ * there's no such process.
+ */
+struct process *pidtable_lookup(pid_t pid);
+void pidtable_add(struct process *p);
+void pidtable_remove(struct process *p);
+
+/* Child lists. lk must be held. */
+void process_addchild(struct proc *parent, struct process *child);
+void process_remchild(struct process *child);
 
 #endif /* _PROC_H_ */
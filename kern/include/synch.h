@@ -36,6 +36,8 @@
 
 
 #include <spinlock.h>
+#include <thread.h>
+#include <lockstat.h>
 
 /*
  * Dijkstra-style semaphore.
@@ -62,6 +64,12 @@ void sem_destroy(struct semaphore *);
 void P(struct semaphore *);
 void V(struct semaphore *);
 
+/*
+ * P_timed is P that gives up after TICKS timer ticks (see clocknap),
+ * returning ETIMEDOUT; 0 if it got the semaphore.
+ */
+int P_timed(struct semaphore *, unsigned ticks);
+
 
 /*
  * Simple lock for mutual exclusion.
@@ -71,6 +79,17 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * An adaptive lock (lock_create_adaptive) is the same, except that a
+ * thread that finds it held by a thread running on another cpu spins
+ * for a while before going to sleep, which is cheaper for locks that
+ * are held only briefly. Adaptive locks also keep statistics, which
+ * lock_printstats() prints for all of them.
+ *
+ * A thread that has to sleep for a lock lends its scheduling priority
+ * to the holder (and on to whatever the holder is waiting for), so
+ * a low-priority holder can't keep it waiting behind unrelated
+ * CPU-bound threads; the holder gets its own back on release.
  */
 struct lock {
         char *lk_name;
@@ -78,10 +97,28 @@ struct lock {
         // (don't forget to mark things volatile as needed)
         struct spinlock spinlock;
         struct wchan *wchan;
-        struct thread *holder;
+        struct thread *volatile holder;
+
+        bool lk_adaptive;               /* spin before sleeping */
+        struct lock *lk_next;           /* list of adaptive locks */
+
+        /* priority inheritance; see synch.c */
+        struct lock *lk_heldnext;       /* holder's t_heldlocks list */
+        unsigned lk_nwaiters;           /* threads asleep on the lock */
+        unsigned lk_waiters[SCHED_NPRIO]; /* ...and at each priority */
+
+        /*
+         * Statistics: adaptive locks, and every lock with the
+         * lockstat option, count acquisitions and hold times in
+         * lk_lockstat. Adaptive locks also count how they got it.
+         */
+        struct lockstat lk_lockstat;
+        unsigned lk_spins;              /* got it by spinning */
+        unsigned lk_blocks;             /* had to sleep */
 };
 
 struct lock *lock_create(const char *name);
+struct lock *lock_create_adaptive(const char *name);
 void lock_acquire(struct lock *);
 
 /*
@@ -98,6 +135,13 @@ void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 void lock_destroy(struct lock *);
+void lock_printstats(void);
+
+/*
+ * Turn priority inheritance on or off (default on), for comparing
+ * the two.
+ */
+void lock_setinherit(bool on);
 
 
 /*
@@ -141,5 +185,62 @@ void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+/*
+ * cv_timedwait is cv_wait that also wakes up after TICKS timer ticks
+ * if not signalled first, and then returns ETIMEDOUT; otherwise 0.
+ * Either way the lock is held again on return.
+ */
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks);
+
+
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * behind it. So a thread must not acquire the read lock recursively,
+ * or a writer arriving in between will deadlock it.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+        char *rw_name;
+        struct spinlock rw_lock;        /* protects the fields below */
+        struct wchan *rw_readwchan;     /* readers wait here */
+        struct wchan *rw_writewchan;    /* writers and upgraders wait here */
+        unsigned rw_readers;            /* threads holding it for read */
+        unsigned rw_waitingwriters;     /* threads waiting to write */
+        struct thread *rw_writer;       /* thread holding it for write */
+        struct thread *rw_upgrader;     /* reader waiting to upgrade */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock shared.
+ *    rwlock_release_read  - Give up a shared hold.
+ *    rwlock_acquire_write - Get the lock exclusively.
+ *    rwlock_release_write - Give up an exclusive hold.
+ *    rwlock_upgrade       - Turn a shared hold into an exclusive one.
+ *                           Returns true if no other writer got in
+ *                           between; false if another upgrade was
+ *                           already pending, in which case the read
+ *                           hold was dropped before waiting to write,
+ *                           and whatever was read must be rechecked.
+ *    rwlock_downgrade     - Turn an exclusive hold into a shared one,
+ *                           without letting any writer in between.
+ *    rwlock_do_i_hold_write - True if the current thread is the writer.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_upgrade(struct rwlock *);
+void rwlock_downgrade(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
 
 #endif /* _SYNCH_H_ */
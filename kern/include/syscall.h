@@ -33,6 +33,8 @@
 #include "opt-A2.h"
 
 struct trapframe; /* from <machine/trapframe.h> */
+struct addrspace;
+struct proc;
 
 /*
  * The system call dispatcher.
@@ -40,6 +42,13 @@ struct trapframe; /* from <machine/trapframe.h> */
 
 void syscall(struct trapframe *tf);
 
+/*
+ * Call numbers are below SYSCALL_NCALLS. syscall_name gives the name
+ * of one, or NULL if there's no such call.
+ */
+#define SYSCALL_NCALLS 128
+const char *syscall_name(int callno);
+
 /*
  * Support functions.
  */
@@ -64,12 +73,37 @@ int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
 void sys__exit(int exitcode);
 int sys_getpid(pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
+int sys_wait4(pid_t pid, userptr_t status, int options, userptr_t rusage,
+              pid_t *retval);
+int sys_getrusage(int who, userptr_t rusage);
+int sys_sysring_enter(userptr_t uring, unsigned n, int *retval);
 
 #endif // UW
 
 #if OPT_A2
 int sys_fork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t progname, userptr_t args);
+int sys_vfork(struct trapframe *tf, pid_t *retval);
+int sys___spawn(userptr_t path, userptr_t argv, pid_t *retval);
+
+/* Let a vfork parent go; true if AS is the one we borrowed from it. */
+bool vfork_done(struct addrspace *as);
+
+/* Leave the current process, tearing it down if we're the last thread. */
+void uthread_leave(void);
+/* On the way back to user mode: leave instead if _exit has been called. */
+void uthread_checkexit(void);
+int sys___thread_create(userptr_t entry, userptr_t func, userptr_t arg,
+                        int *retval);
+void sys_thread_exit(userptr_t retval);
+int sys_thread_join(int tid, userptr_t retvalp);
 #endif /* OPT_A2 */
 
+/* Set up the futex wait table. */
+void futex_bootstrap(void);
+int sys_futex_wait(userptr_t uaddr, int expected);
+int sys_futex_wake(userptr_t uaddr, int n, int *retval);
+/* Wake all of P's futex waiters; P is exiting. */
+void futex_wakeproc(struct proc *p);
+
 #endif /* _SYSCALL_H_ */
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SYSCALLSTATS_H_
+#define _SYSCALLSTATS_H_
+
+/*
+ * System call profiler.
+ *
+ * With the syscallstats option, syscall() counts each call as it
+ * comes in and, when the handler returns, adds the time it took
+ * (from gettime_ns()) to a log2 histogram for that call: bucket b
+ * counts calls that took from 2^b up to 2^(b+1) ns, and the last
+ * bucket everything longer. Calls that don't come back (_exit,
+ * thread_exit, an execv that works) are counted but not timed.
+ *
+ * Counts are kept per cpu, updated at splhigh, and only added up
+ * when printed, so system calls on different cpus never share a
+ * cache line or a lock.
+ *
+ * syscallstats_print shows the TOPN calls with the most total time,
+ * or the histogram for the call named NAME; syscallstats_reset zeroes
+ * everything.
+ */
+
+#include "opt-syscallstats.h"
+
+#define SYSCALLSTATS_NBUCKETS	32
+
+#if OPT_SYSCALLSTATS
+/* Call once the other cpus are up. */
+void syscallstats_bootstrap(void);
+
+/* Count a call to CALLNO, and later its return after NS ns. */
+void syscallstats_enter(int callno);
+void syscallstats_exit(int callno, uint64_t ns);
+#endif
+
+void syscallstats_reset(void);
+void syscallstats_print(unsigned topn, const char *name);
+
+
+#endif /* _SYSCALLSTATS_H_ */
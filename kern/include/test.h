@@ -60,6 +60,11 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int rwtest(int, char **);
+int pitest(int, char **);
+int timedtest(int, char **);
+int atomictest(int, char **);
+int pidtest(int, char **);
 
 #ifdef UW
 /* Another thread and synchronization test */
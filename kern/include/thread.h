@@ -41,11 +41,21 @@
 #include <threadlist.h>
 
 struct cpu;
+struct lock;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
 
 
+/*
+ * Number of priority levels in the multi-level feedback queue
+ * scheduler. Level 0 is the highest priority.
+ */
+#define SCHED_NPRIO 4
+
+/* t_lentpriority when no lock waiter is lending us anything */
+#define SCHED_NOPRIO SCHED_NPRIO
+
 /* Size of kernel stacks; must be power of 2 */
 #define STACK_SIZE 4096
 
@@ -64,6 +74,22 @@ typedef enum {
 	S_ZOMBIE,	/* zombie; exited but not yet deleted */
 } threadstate_t;
 
+/*
+ * Resource usage counts for a thread. Each is only ever bumped by the
+ * thread itself, or by hardclock on its cpu while it's running, so
+ * they need no lock. When the thread leaves its process they're added
+ * into the process's totals; see proc_getusage.
+ */
+struct threadusage {
+	unsigned tu_uticks;		/* hardclocks that found it in user mode */
+	unsigned tu_sticks;		/* ...and in the kernel */
+	unsigned tu_faults;		/* vm_fault calls, i.e. TLB misses */
+	unsigned tu_nvcsw;		/* switches away to sleep or yield */
+	unsigned tu_nivcsw;		/* preemptions */
+	uint64_t tu_inbytes;		/* bytes through VOP_READ */
+	uint64_t tu_outbytes;		/* bytes through VOP_WRITE */
+};
+
 /* Thread structure. */
 struct thread {
 	/*
@@ -98,9 +124,35 @@ struct thread {
 	 * rather than per-cpu or global?
 	 */
 	bool t_in_interrupt;		/* Are we in an interrupt? */
+	bool t_intr_fromuser;		/* ...that came from user mode? */
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Scheduler fields.
+	 *
+	 * These are only changed by the thread's own cpu: either
+	 * while the thread is running, or while it is on that cpu's
+	 * run queue with the run queue lock held.
+	 */
+	int t_priority;			/* MLFQ level; 0 is highest */
+	unsigned t_levelticks;		/* hardclocks used at this level */
+	unsigned t_cputicks;		/* total hardclocks spent running */
+	unsigned t_lastran;		/* cpu's c_hardclocks when switched out */
+	unsigned t_sliceticks;		/* hardclocks run since switched in */
+
+	/*
+	 * Priority inheritance fields; see synch.c. The first three
+	 * are protected by the priority inheritance spinlock there;
+	 * t_heldlocks is only touched by the thread itself.
+	 */
+	int t_lentpriority;		/* best priority lent by waiters */
+	struct lock *t_waitlock;	/* lock we're blocked on, if any */
+	int t_waitprio;			/* priority we wait there at */
+	struct lock *t_heldlocks;	/* locks held, via lk_heldnext */
+
+	struct threadusage t_usage;	/* resource usage; see above */
+
 	/*
 	 * Public fields
 	 */
@@ -124,6 +176,12 @@ void thread_bootstrap(void);
 /* Call late in system startup to get secondary CPUs running. */
 void thread_start_cpus(void);
 
+/* Number of cpus; cpu numbers go from 0 to this minus 1. */
+unsigned thread_numcpus(void);
+
+/* Add the counts in FROM to TO. */
+void threadusage_add(struct threadusage *to, const struct threadusage *from);
+
 /* Call during panic to stop other threads in their tracks */
 void thread_panic(void);
 
@@ -163,10 +221,38 @@ void thread_yield(void);
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Charge the current hardclock tick to the running thread. Called
+ * from hardclock(). Returns true if it's time to preempt it.
+ */
+bool thread_tick(void);
+
+/*
+ * Turn the multi-level feedback queue on or off. When it's off, all
+ * runnable threads get plain round-robin.
+ */
+void schedule_setmlfq(bool on);
+
+/*
+ * Effective priority of T: its own MLFQ level, or a better one lent
+ * to it by a thread waiting on a lock it holds.
  */
-void thread_consider_migration(void);
+int thread_priority(const struct thread *t);
+
+/*
+ * What thread_priority(T) will be once T blocks, which can move it up
+ * a level; for the lock code to count it at as a waiter beforehand.
+ */
+int thread_sleeppriority(const struct thread *t);
+
+/*
+ * Set the priority lent to T (SCHED_NOPRIO for none), moving it up
+ * or down its cpu's run queue if it's waiting there. Called by the
+ * lock code with its priority inheritance spinlock held.
+ */
+void thread_lendpriority(struct thread *t, int prio);
+
+/* Print per-cpu thread system statistics. */
+void thread_printstats(void);
 
 
 #endif /* _THREAD_H_ */
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _TICKETLOCK_H_
+#define _TICKETLOCK_H_
+
+/*
+ * Ticket spinlocks.
+ *
+ * These work like spinlocks (same rules: held by a CPU, interrupts
+ * off while held, no sleeping) but are handed out in arrival order.
+ * Each acquirer takes the next ticket and spins until the lock is
+ * serving that ticket, so no CPU can be starved by others that
+ * happen to win the test-and-set race over and over. Use them for
+ * locks that are hot on multiprocessor configurations.
+ *
+ * The name is for statistics and debugging; it should be a string
+ * constant.
+ *
+ * With the ticketstats option, each lock counts acquisitions, how
+ * many of those had to wait, total spin iterations, and the longest
+ * hold time. ticketlock_printstats() prints them for every ticket
+ * lock that has been used. All but the spins are kept in tl_lockstat,
+ * which the lockstat option uses as well; see lockstat.h.
+ */
+
+#include <spinlock.h>
+#include <lockstat.h>
+#include "opt-ticketstats.h"
+
+struct ticketlock {
+	volatile spinlock_data_t tl_next;	/* next ticket to hand out */
+	volatile spinlock_data_t tl_serving;	/* ticket now holding it */
+	struct cpu *tl_holder;			/* CPU holding this lock */
+	const char *tl_name;
+#if OPT_TICKETSTATS
+	struct ticketlock *tl_statnext;		/* list of used locks */
+	bool tl_statlisted;			/* on that list yet? */
+	unsigned long tl_spins;			/* total spin iterations */
+#endif
+#if OPT_TICKETSTATS || OPT_LOCKSTAT
+	struct lockstat tl_lockstat;		/* acquires, hold times */
+#endif
+};
+
+/* Statistics fields not named here start out zero, which is right. */
+#define TICKETLOCK_INITIALIZER(name) {			\
+	.tl_next = SPINLOCK_DATA_INITIALIZER,		\
+	.tl_serving = SPINLOCK_DATA_INITIALIZER,	\
+	.tl_holder = NULL,				\
+	.tl_name = name,				\
+}
+
+/*
+ * Functions; the same as the spinlock ones.
+ *
+ * init		Initialize the contents of a ticket lock.
+ * cleanup	Opposite of init. Lock must be unlocked.
+ *
+ * acquire	Get the lock, spinning as necessary. Also disables interrupts.
+ * release	Release the lock. May re-enable interrupts.
+ *
+ * do_i_hold	Check if the current CPU holds the lock.
+ */
+void ticketlock_init(struct ticketlock *tl, const char *name);
+void ticketlock_cleanup(struct ticketlock *tl);
+
+void ticketlock_acquire(struct ticketlock *tl);
+void ticketlock_release(struct ticketlock *tl);
+
+bool ticketlock_do_i_hold(struct ticketlock *tl);
+
+/* Print the statistics, or say they aren't compiled in. */
+void ticketlock_printstats(void);
+
+
+#endif /* _TICKETLOCK_H_ */
@@ -30,6 +30,7 @@
 #ifndef _VNODE_H_
 #define _VNODE_H_
 
+#include <atomic.h>
 
 struct uio;
 struct stat;
@@ -47,13 +48,17 @@ struct stat;
  *
  * Note: vn_fs may be null if the vnode refers to a device.
  *
+ * vn_refcount is atomic so that VOP_INCREF, and VOP_DECREF when it
+ * isn't dropping the last reference, don't need the VFS big lock.
+ *
  * vn_opencount is managed using VOP_INCOPEN and VOP_DECOPEN by
  * vfs_open() and vfs_close(). Code above the VFS layer should not
  * need to worry about it.
  */
 struct vnode {
-	int vn_refcount;                /* Reference count */
+	struct atomic vn_refcount;      /* Reference count */
 	int vn_opencount;
+	struct atomic vn_writegen;      /* Writes and truncates so far */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
@@ -245,17 +250,17 @@ struct vnode_ops {
 #define VOP_CLOSE(vn)                   (__VOP(vn, close)(vn))
 #define VOP_RECLAIM(vn)                 (__VOP(vn, reclaim)(vn))
 
-#define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
+#define VOP_READ(vn, uio)               vnode_read(vn, uio)
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
-#define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
+#define VOP_WRITE(vn, uio)              vnode_write(vn, uio)
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_TRYSEEK(vn, pos)            (__VOP(vn, tryseek)(vn, pos))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
-#define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#define VOP_TRUNCATE(vn, pos)           vnode_truncate(vn, pos)
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
@@ -274,6 +279,19 @@ struct vnode_ops {
  */
 void vnode_check(struct vnode *, const char *op);
 
+/*
+ * VOP_WRITE and VOP_TRUNCATE go through these, which count each call
+ * in vn_writegen once the filesystem is done. Anything caching what's
+ * in a file (see loadelf.c) can note vnode_writegen before reading it
+ * and compare later to see if the file may have changed since.
+ * VOP_READ and VOP_WRITE also charge the bytes moved to the current
+ * thread's resource usage.
+ */
+int vnode_read(struct vnode *vn, struct uio *uio);
+int vnode_write(struct vnode *vn, struct uio *uio);
+int vnode_truncate(struct vnode *vn, off_t pos);
+unsigned vnode_writegen(struct vnode *vn);
+
 /*
  * Reference count manipulation (handled above filesystem level)
  */
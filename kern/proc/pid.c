@@ -0,0 +1,212 @@
+/*
+ * Process id allocation.
+ *
+ * pid_map has a bit for each pid, set while the pid is in use, and
+ * pid_full has a bit for each word of pid_map, set while that word is
+ * all ones; so a search looks at no more than a couple of words of
+ * pid_map and skips past used stretches 32 words (1024 pids) at a
+ * time. Searches are next-fit: they start after the last pid handed
+ * out and wrap around, so pids go round in sequence.
+ *
+ * A freed pid is not made available at once but goes on a queue of
+ * the last PID_REUSE_DELAY freed, and is only cleared in pid_map when
+ * pushed out of the queue by later ones. Along with the next-fit
+ * search this keeps a pid from coming straight back, which makes
+ * stale pids in user programs (and in our debug output) much less
+ * likely to name the wrong process.
+ *
+ * Everything is in fixed-size static arrays and the work done is
+ * bounded and small, so the allocator just uses a spinlock and never
+ * allocates memory.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <limits.h>
+#include <spinlock.h>
+#include <proc.h>
+
+#define PID_NBITS	(PID_MAX + 1)
+#define PIDMAP_WORDS	((PID_NBITS + 31) / 32)
+#define PIDFULL_WORDS	((PIDMAP_WORDS + 31) / 32)
+#define ALLONES		0xffffffffU
+
+#define PID_REUSE_DELAY	128
+
+static struct spinlock pid_spinlock = SPINLOCK_INITIALIZER;
+static uint32_t pid_map[PIDMAP_WORDS];
+static uint32_t pid_full[PIDFULL_WORDS];
+static unsigned pid_next;			/* where the next search starts */
+
+/* recently freed pids, oldest at pid_delayhead once it's full */
+static pid_t pid_delayed[PID_REUSE_DELAY];
+static unsigned pid_ndelayed;
+static unsigned pid_delayhead;
+
+/*
+ * Position of the lowest clear bit in x, which mustn't be all ones.
+ */
+static
+unsigned
+firstclear(uint32_t x)
+{
+	unsigned pos = 0;
+
+	x = ~x;
+	KASSERT(x != 0);
+	if ((x & 0xffff) == 0) { pos += 16; x >>= 16; }
+	if ((x & 0xff) == 0) { pos += 8; x >>= 8; }
+	if ((x & 0xf) == 0) { pos += 4; x >>= 4; }
+	if ((x & 0x3) == 0) { pos += 2; x >>= 2; }
+	if ((x & 0x1) == 0) { pos += 1; }
+	return pos;
+}
+
+/*
+ * Index of the first clear bit at or after start in the nwords-word
+ * bitmap map, or -1 if there isn't one. Bits past the end of the last
+ * word are assumed to be set.
+ */
+static
+int
+findclear(const uint32_t *map, unsigned nwords, unsigned start)
+{
+	unsigned w;
+	uint32_t bits;
+
+	w = start / 32;
+	if (w >= nwords) {
+		return -1;
+	}
+	bits = map[w] | ((1U << (start % 32)) - 1);
+	while (bits == ALLONES) {
+		if (++w >= nwords) {
+			return -1;
+		}
+		bits = map[w];
+	}
+	return w * 32 + firstclear(bits);
+}
+
+/*
+ * First free pid at or after start, or -1.
+ */
+static
+int
+pid_findfree(unsigned start)
+{
+	unsigned w;
+	uint32_t bits;
+	int fw;
+
+	w = start / 32;
+	bits = pid_map[w] | ((1U << (start % 32)) - 1);
+	if (bits != ALLONES) {
+		return w * 32 + firstclear(bits);
+	}
+	fw = findclear(pid_full, PIDFULL_WORDS, w + 1);
+	if (fw < 0 || fw >= PIDMAP_WORDS) {
+		return -1;
+	}
+	return fw * 32 + firstclear(pid_map[fw]);
+}
+
+static
+void
+pid_setbit(unsigned pid)
+{
+	unsigned w = pid / 32;
+
+	KASSERT((pid_map[w] & (1U << (pid % 32))) == 0);
+	pid_map[w] |= 1U << (pid % 32);
+	if (pid_map[w] == ALLONES) {
+		pid_full[w / 32] |= 1U << (w % 32);
+	}
+}
+
+static
+void
+pid_clearbit(unsigned pid)
+{
+	unsigned w = pid / 32;
+
+	KASSERT((pid_map[w] & (1U << (pid % 32))) != 0);
+	pid_full[w / 32] &= ~(1U << (w % 32));
+	pid_map[w] &= ~(1U << (pid % 32));
+}
+
+void
+pid_bootstrap(void)
+{
+	unsigned i;
+
+	bzero(pid_map, sizeof(pid_map));
+	bzero(pid_full, sizeof(pid_full));
+	/* pids below PID_MIN, and any padding past PID_MAX, never go out */
+	for (i=0; i<PID_MIN; i++) {
+		pid_setbit(i);
+	}
+	for (i=PID_NBITS; i<PIDMAP_WORDS * 32; i++) {
+		pid_setbit(i);
+	}
+	pid_next = PID_MIN;
+	pid_ndelayed = 0;
+	pid_delayhead = 0;
+}
+
+/*
+ * Get an unused pid. Fails with ENPROC if there are none, except
+ * that as a last resort it takes back the longest-delayed freed one.
+ */
+int
+pid_alloc(pid_t *ret)
+{
+	int pid;
+
+	spinlock_acquire(&pid_spinlock);
+	pid = pid_findfree(pid_next);
+	if (pid < 0) {
+		pid = pid_findfree(PID_MIN);
+	}
+	if (pid >= 0) {
+		pid_setbit(pid);
+	}
+	else if (pid_ndelayed > 0) {
+		/* it's still marked in use, so just hand it out again */
+		pid = pid_delayed[(pid_delayhead + PID_REUSE_DELAY -
+				   pid_ndelayed) % PID_REUSE_DELAY];
+		pid_ndelayed--;
+	}
+	else {
+		spinlock_release(&pid_spinlock);
+		return ENPROC;
+	}
+	pid_next = (pid >= PID_MAX) ? PID_MIN : pid + 1;
+	spinlock_release(&pid_spinlock);
+
+	*ret = pid;
+	return 0;
+}
+
+/*
+ * Give back a pid. It becomes free once PID_REUSE_DELAY more have
+ * been given back.
+ */
+void
+pid_free(pid_t pid)
+{
+	KASSERT(pid >= PID_MIN && pid <= PID_MAX);
+
+	spinlock_acquire(&pid_spinlock);
+	if (pid_ndelayed == PID_REUSE_DELAY) {
+		/* the queue is full, so the head is the oldest */
+		pid_clearbit(pid_delayed[pid_delayhead]);
+	}
+	else {
+		pid_ndelayed++;
+	}
+	pid_delayed[pid_delayhead] = pid;
+	pid_delayhead = (pid_delayhead + 1) % PID_REUSE_DELAY;
+	spinlock_release(&pid_spinlock);
+}
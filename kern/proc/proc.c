@@ -51,7 +51,6 @@
 #include <synch.h>
 #include <kern/fcntl.h>  
 #include <limits.h>
-#include <queue.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -71,9 +70,13 @@ static struct semaphore *proc_count_mutex;
 struct semaphore *no_proc_sem;   
 #endif  // UW
 
-static volatile pid_t pid_count;
-struct lock *pid_lock;
-struct queue *pidq;
+/*
+ * Hash table of struct process, by pid. Pids are handed out mostly
+ * in sequence, so the low bits alone spread them evenly.
+ */
+#define PIDTABLE_SIZE 1024	/* power of 2 */
+#define PIDTABLE_HASH(pid) ((unsigned)(pid) & (PIDTABLE_SIZE - 1))
+static struct process *pidtable[PIDTABLE_SIZE];
 
 /*
  * Create a proc structure.
@@ -103,10 +106,45 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
+	bzero(&proc->p_usage, sizeof(proc->p_usage));
+	bzero(&proc->p_childusage, sizeof(proc->p_childusage));
+
 #ifdef UW
 	proc->console = NULL;
 #endif // UW
 
+#if OPT_A2
+	proc->p_uthread_lock = lock_create("p_uthread_lock");
+	if (proc->p_uthread_lock == NULL) {
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+	proc->p_uthread_cv = cv_create("p_uthread_cv");
+	if (proc->p_uthread_cv == NULL) {
+		lock_destroy(proc->p_uthread_lock);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+	proc->p_uthreads = NULL;
+	proc->p_nexttid = 1;
+	proc->p_nuthreads = 0;
+	proc->p_exiting = false;
+	proc->p_exitcode = 0;
+	proc->p_children = NULL;
+	proc->p_zombies = NULL;
+	proc->p_vfork = NULL;
+	proc->p_childcv = cv_create("p_childcv");
+	if (proc->p_childcv == NULL) {
+		cv_destroy(proc->p_uthread_cv);
+		lock_destroy(proc->p_uthread_lock);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+#endif /* OPT_A2 */
+
 	return proc;
 }
 
@@ -167,6 +205,19 @@ proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
+#if OPT_A2
+	while (proc->p_uthreads != NULL) {
+		struct uthread *ut = proc->p_uthreads;
+
+		proc->p_uthreads = ut->ut_next;
+		kfree(ut);
+	}
+	KASSERT(proc->p_children == NULL && proc->p_zombies == NULL);
+	cv_destroy(proc->p_childcv);
+	cv_destroy(proc->p_uthread_cv);
+	lock_destroy(proc->p_uthread_lock);
+#endif /* OPT_A2 */
+
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
 
@@ -197,6 +248,8 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+  unsigned i;
+
   kproc = proc_create("[kernel]");
   if (kproc == NULL) {
     panic("proc_create for kproc failed\n");
@@ -213,18 +266,14 @@ proc_bootstrap(void)
   }
 #endif // UW 
 
-  procTable = array_create();
-  pid_count = PID_MIN;
-  pid_lock = lock_create("pidlock");
-  if (pid_lock == NULL) {
-    panic("could not create pid_lock\n");
+  for (i = 0; i < PIDTABLE_SIZE; i++) {
+    pidtable[i] = NULL;
   }
-  pidq = q_create(10);
-  if (pidq == NULL) {
-    panic("could not create pid queue\n");
+  pid_bootstrap();
+  lk = lock_create_adaptive("lk");
+  if (lk == NULL) {
+    panic("could not create lk\n");
   }
-  lk = lock_create("lk");
-  cv = cv_create("cv");
 
 }
 
@@ -238,6 +287,7 @@ struct proc *
 proc_create_runprogram(const char *name)
 {
 	struct proc *proc;
+	struct process *rec;
 	char *console_path;
 
 	proc = proc_create(name);
@@ -261,6 +311,11 @@ proc_create_runprogram(const char *name)
 
 	proc->p_addrspace = NULL;
 
+#if OPT_A2
+	/* the thread that runprogram or fork is about to start */
+	proc->p_nuthreads = 1;
+#endif
+
 	/* VFS fields */
 
 #ifdef UW
@@ -289,18 +344,29 @@ proc_create_runprogram(const char *name)
 	V(proc_count_mutex);
 #endif // UW
 
-  lock_acquire(pid_lock);
-  if (q_peek(pidq) == NULL) {
-    if (pid_count >= PID_MAX) return NULL;
-    proc->pid = pid_count;
-    pid_count++;
-  } else {
-    pid_t *p = q_peek(pidq);
-    proc->pid = *p;
-    kfree(p);
-    q_remhead(pidq);
+  if (pid_alloc(&proc->pid)) {
+    proc_destroy(proc);
+    return NULL;
+  }
+
+  /* A record for the parent to collect our exit status from */
+  rec = kmalloc(sizeof(*rec));
+  if (rec == NULL) {
+    pid_free(proc->pid);
+    proc_destroy(proc);
+    return NULL;
+  }
+  rec->pid = proc->pid;
+  rec->exited = false;
+  rec->exitcode = 0;
+  rec->parent = NULL;
+  lock_acquire(lk);
+  pidtable_add(rec);
+  if (curproc != kproc) {
+    /* forked; programs run from the menu have nobody to wait for them */
+    process_addchild(curproc, rec);
   }
-  lock_release(pid_lock);
+  lock_release(lk);
 
 	return proc;
 }
@@ -345,6 +411,7 @@ proc_remthread(struct thread *t)
 	for (i=0; i<num; i++) {
 		if (threadarray_get(&proc->p_threads, i) == t) {
 			threadarray_remove(&proc->p_threads, i);
+			threadusage_add(&proc->p_usage, &t->t_usage);
 			spinlock_release(&proc->p_lock);
 			t->t_proc = NULL;
 			return;
@@ -355,6 +422,29 @@ proc_remthread(struct thread *t)
 	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
 }
 
+/*
+ * Add up a process's resource usage. The counts of threads still
+ * running are read without stopping them, which is good enough for
+ * statistics.
+ */
+void
+proc_getusage(struct proc *proc, struct threadusage *tu, bool children)
+{
+	unsigned i, num;
+
+	spinlock_acquire(&proc->p_lock);
+	*tu = proc->p_usage;
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num; i++) {
+		threadusage_add(tu,
+			&threadarray_get(&proc->p_threads, i)->t_usage);
+	}
+	if (children) {
+		threadusage_add(tu, &proc->p_childusage);
+	}
+	spinlock_release(&proc->p_lock);
+}
+
 /*
  * Fetch the address space of the current process. Caution: it isn't
  * refcounted. If you implement multithreaded processes, make sure to
@@ -396,10 +486,79 @@ curproc_setas(struct addrspace *newas)
 	return oldas;
 }
 
-void addPid(pid_t pid) {
-  lock_acquire(pid_lock);
-  pid_t *p = kmalloc(sizeof(pid_t));
-  *p = pid;
-  q_addtail(pidq, p);
-  lock_release(pid_lock);
+struct process *
+pidtable_lookup(pid_t pid)
+{
+  struct process *p;
+
+  KASSERT(lock_do_i_hold(lk));
+  for (p = pidtable[PIDTABLE_HASH(pid)]; p != NULL; p = p->next) {
+    if (p->pid == pid) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+void
+pidtable_add(struct process *p)
+{
+  struct process **bucket;
+
+  KASSERT(lock_do_i_hold(lk));
+  KASSERT(pidtable_lookup(p->pid) == NULL);
+  bucket = &pidtable[PIDTABLE_HASH(p->pid)];
+  p->next = *bucket;
+  p->prevp = bucket;
+  if (*bucket != NULL) {
+    (*bucket)->prevp = &p->next;
+  }
+  *bucket = p;
+}
+
+void
+pidtable_remove(struct process *p)
+{
+  KASSERT(lock_do_i_hold(lk));
+  *p->prevp = p->next;
+  if (p->next != NULL) {
+    p->next->prevp = p->prevp;
+  }
+  p->next = NULL;
+  p->prevp = NULL;
+}
+
+/*
+ * Children that have exited go on p_zombies instead of p_children,
+ * so waitpid(-1) only has to look at the first one there.
+ */
+void
+process_addchild(struct proc *parent, struct process *child)
+{
+  struct process **pp;
+
+  KASSERT(lock_do_i_hold(lk));
+  KASSERT(child->parent == NULL);
+  pp = child->exited ? &parent->p_zombies : &parent->p_children;
+  child->parent = parent;
+  child->sibnext = *pp;
+  child->sibprevp = pp;
+  if (*pp != NULL) {
+    (*pp)->sibprevp = &child->sibnext;
+  }
+  *pp = child;
+}
+
+void
+process_remchild(struct process *child)
+{
+  KASSERT(lock_do_i_hold(lk));
+  KASSERT(child->parent != NULL);
+  *child->sibprevp = child->sibnext;
+  if (child->sibnext != NULL) {
+    child->sibnext->sibprevp = child->sibprevp;
+  }
+  child->parent = NULL;
+  child->sibnext = NULL;
+  child->sibprevp = NULL;
 }
@@ -0,0 +1,168 @@
+/*
+ * Address space reaper.
+ *
+ * Destroying a user address space frees every page in it, which takes
+ * time in proportion to its size. Done in _exit, that holds up the
+ * exiting process and so whoever is waiting to collect it; done in
+ * execv, it holds up the new program. Instead the address space is
+ * handed to reaper_add, which queues it for a reaper thread to
+ * destroy in the background.
+ *
+ * There is a queue and a reaper thread for each cpu; reaper_add uses
+ * the current cpu's, so exits on different cpus don't contend. (The
+ * reaper threads all start on the boot cpu, and are spread out by
+ * work stealing like any other thread.) A queue holds at most
+ * REAPER_QLEN address spaces. If it's full the caller destroys its
+ * own, so memory can't be held up in the queues faster than the
+ * reapers free it.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <proc.h>
+
+#define REAPER_QLEN 16
+
+struct reaper {
+	struct spinlock r_lock;
+	struct semaphore *r_sem;	/* counts queued address spaces */
+	struct addrspace *r_queue[REAPER_QLEN];
+	unsigned r_head;		/* oldest queued */
+	unsigned r_count;
+	unsigned r_reaped;		/* stats; protected by r_lock */
+	unsigned r_inline;		/* queue was full */
+	unsigned r_maxqueued;
+};
+
+static struct reaper *reapers;
+static unsigned nreapers;
+
+static
+void
+reaper_thread(void *data, unsigned long unused)
+{
+	struct reaper *r = data;
+	struct addrspace *as;
+
+	(void)unused;
+
+	while (1) {
+		P(r->r_sem);
+		spinlock_acquire(&r->r_lock);
+		KASSERT(r->r_count > 0);
+		as = r->r_queue[r->r_head];
+		r->r_queue[r->r_head] = NULL;
+		r->r_head = (r->r_head + 1) % REAPER_QLEN;
+		r->r_count--;
+		spinlock_release(&r->r_lock);
+
+		as_destroy(as);
+
+		spinlock_acquire(&r->r_lock);
+		r->r_reaped++;
+		spinlock_release(&r->r_lock);
+	}
+}
+
+void
+reaper_bootstrap(void)
+{
+	struct reaper *r;
+	char name[16];
+	unsigned i;
+	int result;
+
+	nreapers = thread_numcpus();
+	reapers = kmalloc(nreapers * sizeof(*reapers));
+	if (reapers == NULL) {
+		panic("reaper_bootstrap: out of memory\n");
+	}
+	for (i=0; i<nreapers; i++) {
+		r = &reapers[i];
+		spinlock_init(&r->r_lock);
+		r->r_sem = sem_create("reaper", 0);
+		if (r->r_sem == NULL) {
+			panic("reaper_bootstrap: out of memory\n");
+		}
+		r->r_head = 0;
+		r->r_count = 0;
+		r->r_reaped = 0;
+		r->r_inline = 0;
+		r->r_maxqueued = 0;
+
+		snprintf(name, sizeof(name), "reaper%u", i);
+		result = thread_fork(name, NULL, reaper_thread, r, 0);
+		if (result) {
+			panic("reaper_bootstrap: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+}
+
+/*
+ * Destroy AS, which mustn't be anyone's address space any more, in
+ * the background if the current cpu's reaper has room for it.
+ */
+void
+reaper_add(struct addrspace *as)
+{
+	struct reaper *r;
+	bool full;
+
+	KASSERT(as != NULL);
+	if (reapers == NULL) {
+		/* not started yet */
+		as_destroy(as);
+		return;
+	}
+
+	/* if we move to another cpu after this, no matter */
+	r = &reapers[curcpu->c_number];
+
+	spinlock_acquire(&r->r_lock);
+	full = (r->r_count == REAPER_QLEN);
+	if (full) {
+		r->r_inline++;
+	}
+	else {
+		r->r_queue[(r->r_head + r->r_count) % REAPER_QLEN] = as;
+		r->r_count++;
+		if (r->r_count > r->r_maxqueued) {
+			r->r_maxqueued = r->r_count;
+		}
+	}
+	spinlock_release(&r->r_lock);
+
+	if (full) {
+		as_destroy(as);
+	}
+	else {
+		V(r->r_sem);
+	}
+}
+
+void
+reaper_printstats(void)
+{
+	struct reaper *r;
+	unsigned i, reaped, count, maxqueued, ninline;
+
+	for (i=0; i<nreapers; i++) {
+		r = &reapers[i];
+		spinlock_acquire(&r->r_lock);
+		reaped = r->r_reaped;
+		count = r->r_count;
+		maxqueued = r->r_maxqueued;
+		ninline = r->r_inline;
+		spinlock_release(&r->r_lock);
+		kprintf("reaper%u: %u reaped, %u queued (max %u), "
+			"%u destroyed inline\n", i, reaped, count,
+			maxqueued, ninline);
+	}
+}
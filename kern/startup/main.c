@@ -47,6 +47,7 @@
 #include <vfs.h>
 #include <device.h>
 #include <syscall.h>
+#include <syscallstats.h>
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
@@ -110,6 +111,7 @@ boot(void)
 	proc_bootstrap();
 	thread_bootstrap();
 	hardclock_bootstrap();
+	futex_bootstrap();
 	vfs_bootstrap();
 
 	/* Probe and initialize devices. Interrupts should come on. */
@@ -125,6 +127,10 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	reaper_bootstrap();
+#if OPT_SYSCALLSTATS
+	syscallstats_bootstrap();
+#endif
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
@@ -37,7 +37,11 @@
 #include <clock.h>
 #include <thread.h>
 #include <proc.h>
+#include <addrspace.h>
 #include <synch.h>
+#include <ticketlock.h>
+#include <lockstat.h>
+#include <syscallstats.h>
 #include <vfs.h>
 #include <sfs.h>
 #include <syscall.h>
@@ -409,6 +413,151 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_threadstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_kheapprofile(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		kheap_resetprofile();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: kmp [reset]\n");
+		return EINVAL;
+	}
+
+	kheap_printprofile();
+
+	return 0;
+}
+
+static
+int
+cmd_reaperstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	reaper_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_elfcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	elfcache_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_lockstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lock_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_ticketlockstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	ticketlock_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	int topn = 10;
+
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+		return 0;
+	}
+	if (nargs == 2) {
+		topn = atoi(args[1]);
+	}
+	if (nargs > 2 || topn <= 0) {
+		kprintf("Usage: lst [reset | N]\n");
+		return EINVAL;
+	}
+
+	lockstat_print(topn);
+
+	return 0;
+}
+
+static
+int
+cmd_syscallstats(int nargs, char **args)
+{
+	int topn = 20;
+
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		syscallstats_reset();
+		return 0;
+	}
+	if (nargs == 2 && (args[1][0] < '0' || args[1][0] > '9')) {
+		/* not a number; take it as the name of a call */
+		syscallstats_print(0, args[1]);
+		return 0;
+	}
+	if (nargs == 2) {
+		topn = atoi(args[1]);
+	}
+	if (nargs > 2 || topn <= 0) {
+		kprintf("Usage: scs [reset | N | callname]\n");
+		return EINVAL;
+	}
+
+	syscallstats_print(topn, NULL);
+
+	return 0;
+}
+
+static
+int
+cmd_sched(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "rr")) {
+		schedule_setmlfq(false);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "mlfq")) {
+		schedule_setmlfq(true);
+		return 0;
+	}
+	kprintf("Usage: sched rr|mlfq\n");
+	return EINVAL;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -478,6 +627,11 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] RW lock test          (1)     ",
+	"[sy5] Priority inversion    (1)     ",
+	"[sy6] Timed wait test       (1)     ",
+	"[atm] Atomic ops test/benchmark     ",
+	"[pid] Pid table test/benchmark      ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -519,6 +673,15 @@ static const char *mainmenu[] = {
 #endif
   "[dth] Enable debug messages         ",
 	"[kh] Kernel heap stats              ",
+	"[kmp] kmalloc profile [reset]       ",
+	"[ts] Thread system stats            ",
+	"[rps] Address space reaper stats    ",
+	"[ec] Executable header cache stats  ",
+	"[sched] Scheduler: rr|mlfq          ",
+	"[lks] Adaptive lock stats           ",
+	"[tls] Ticket lock stats             ",
+	"[lst] Lock profile [reset | N]      ",
+	"[scs] Syscall profile [reset|N|call]",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -578,6 +741,15 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "kmp",        cmd_kheapprofile },
+	{ "ts",         cmd_threadstats },
+	{ "rps",        cmd_reaperstats },
+	{ "ec",         cmd_elfcachestats },
+	{ "sched",      cmd_sched },
+	{ "lks",        cmd_lockstats },
+	{ "tls",        cmd_ticketlockstats },
+	{ "lst",        cmd_lockstat },
+	{ "scs",        cmd_syscallstats },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -595,6 +767,11 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	rwtest },
+	{ "sy5",	pitest },
+	{ "sy6",	timedtest },
+	{ "atm",	atomictest },
+	{ "pid",	pidtest },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
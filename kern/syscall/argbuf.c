@@ -0,0 +1,132 @@
+/*
+ * Copying program arguments between address spaces. See argbuf.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <limits.h>
+#include <copyinout.h>
+#include <argbuf.h>
+
+int
+argbuf_copyin(struct argbuf *ab, userptr_t uargv)
+{
+	userptr_t uarg;
+	size_t used, got;
+	int result;
+
+	ab->ab_buf = kmalloc(ARG_MAX);
+	if (ab->ab_buf == NULL) {
+		return ENOMEM;
+	}
+	ab->ab_len = 0;
+	ab->ab_nargs = 0;
+
+	while (1) {
+		result = copyin(uargv + ab->ab_nargs * sizeof(userptr_t),
+				&uarg, sizeof(uarg));
+		if (result) {
+			goto fail;
+		}
+		if (uarg == NULL) {
+			break;
+		}
+
+		/* count this argument's pointer and the final NULL */
+		used = ab->ab_len + (ab->ab_nargs + 2) * sizeof(userptr_t);
+		if (used >= ARG_MAX) {
+			result = E2BIG;
+			goto fail;
+		}
+		result = copyinstr(uarg, ab->ab_buf + ab->ab_len,
+				   ARG_MAX - used, &got);
+		if (result == ENAMETOOLONG) {
+			result = E2BIG;
+		}
+		if (result) {
+			goto fail;
+		}
+		ab->ab_len += got;
+		ab->ab_nargs++;
+	}
+	return 0;
+
+ fail:
+	argbuf_cleanup(ab);
+	return result;
+}
+
+int
+argbuf_fromkernel(struct argbuf *ab, char **args, int nargs)
+{
+	size_t used, len;
+	int i;
+
+	ab->ab_buf = kmalloc(ARG_MAX);
+	if (ab->ab_buf == NULL) {
+		return ENOMEM;
+	}
+	ab->ab_len = 0;
+	ab->ab_nargs = 0;
+
+	for (i=0; i<nargs; i++) {
+		used = ab->ab_len + (ab->ab_nargs + 2) * sizeof(userptr_t);
+		len = strlen(args[i]) + 1;
+		if (used + len > ARG_MAX) {
+			argbuf_cleanup(ab);
+			return E2BIG;
+		}
+		memcpy(ab->ab_buf + ab->ab_len, args[i], len);
+		ab->ab_len += len;
+		ab->ab_nargs++;
+	}
+	return 0;
+}
+
+/*
+ * Put the arguments at the top of the user stack that *STACKPTR
+ * points to, which must be in the current address space. Moves
+ * *STACKPTR down past them and sets *UARGV to where argv went.
+ */
+int
+argbuf_copyout(struct argbuf *ab, vaddr_t *stackptr, userptr_t *uargv)
+{
+	userptr_t *argv;
+	size_t ptrsize, size, pos;
+	vaddr_t base;
+	int i, result;
+
+	KASSERT(ab->ab_buf != NULL);
+
+	/* argv[], then the strings; argbuf_copyin made sure it fits */
+	ptrsize = (ab->ab_nargs + 1) * sizeof(userptr_t);
+	size = ROUNDUP(ptrsize + ab->ab_len, 8);
+	KASSERT(size <= ARG_MAX);
+	base = *stackptr - size;
+
+	memmove(ab->ab_buf + ptrsize, ab->ab_buf, ab->ab_len);
+	bzero(ab->ab_buf + ptrsize + ab->ab_len, size - ptrsize - ab->ab_len);
+	argv = (userptr_t *)ab->ab_buf;
+	pos = ptrsize;
+	for (i=0; i<ab->ab_nargs; i++) {
+		argv[i] = (userptr_t)(base + pos);
+		pos += strlen(ab->ab_buf + pos) + 1;
+	}
+	argv[ab->ab_nargs] = NULL;
+
+	result = copyout(ab->ab_buf, (userptr_t)base, size);
+	if (result) {
+		return result;
+	}
+	*stackptr = base;
+	*uargv = (userptr_t)base;
+	return 0;
+}
+
+void
+argbuf_cleanup(struct argbuf *ab)
+{
+	kfree(ab->ab_buf);
+	ab->ab_buf = NULL;
+}
@@ -0,0 +1,202 @@
+/*
+ * Futex system calls: let user programs sleep on a word of their own
+ * memory, so that user-level locks only need the kernel when there is
+ * contention.
+ *
+ * futex_wait(addr, expected) sleeps as long as *addr == expected,
+ * until someone calls futex_wake on the same address; if *addr has
+ * already changed it returns EAGAIN at once. futex_wake(addr, n)
+ * wakes up to n such sleepers and returns how many it woke.
+ *
+ * Waiters are kept in a hash table keyed by (address space, user
+ * address). Each bucket has a lock, which futex_wait holds from
+ * reading *addr until it is on the bucket's list; so a waker that
+ * changes *addr and then calls futex_wake either makes the read see
+ * the new value or finds the waiter on the list. Each waiter has a
+ * record on its stack that the waker marks and unlinks; since waiters
+ * with different keys share a bucket's cv, everyone in the bucket is
+ * woken and those not marked go back to sleep. When a process calls
+ * _exit, futex_wakeproc wakes all of its waiters, which return EINTR.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+#define FUTEX_NBUCKETS 32
+
+struct futex_waiter {
+	struct proc *fw_proc;
+	struct addrspace *fw_as;
+	vaddr_t fw_addr;
+	bool fw_woken;			/* protected by the bucket lock */
+	struct futex_waiter *fw_next;
+};
+
+struct futex_bucket {
+	struct lock *fb_lock;
+	struct cv *fb_cv;
+	struct futex_waiter *fb_waiters;
+};
+
+static struct futex_bucket futex_table[FUTEX_NBUCKETS];
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		futex_table[i].fb_lock = lock_create("futex");
+		futex_table[i].fb_cv = cv_create("futex");
+		if (futex_table[i].fb_lock == NULL ||
+		    futex_table[i].fb_cv == NULL) {
+			panic("futex_bootstrap: out of memory\n");
+		}
+		futex_table[i].fb_waiters = NULL;
+	}
+}
+
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, vaddr_t addr)
+{
+	uintptr_t h;
+
+	h = (uintptr_t)as ^ (addr >> 2);
+	h ^= h >> 7;
+	return &futex_table[h % FUTEX_NBUCKETS];
+}
+
+int
+sys_futex_wait(userptr_t uaddr, int expected)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter fw, **fwp;
+	int val, result;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+
+	fw.fw_proc = curproc;
+	fw.fw_as = curproc_getas();
+	fw.fw_addr = (vaddr_t)uaddr;
+	fw.fw_woken = false;
+	fb = futex_hash(fw.fw_as, fw.fw_addr);
+
+	lock_acquire(fb->fb_lock);
+	/*
+	 * _exit sets p_exiting before futex_wakeproc goes through the
+	 * buckets, so if it has been here already we see it now.
+	 */
+	if (curproc->p_exiting) {
+		lock_release(fb->fb_lock);
+		return EINTR;
+	}
+	result = copyin(uaddr, &val, sizeof(val));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (val != expected) {
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+
+	/* Wakers take from the head, so add at the tail for fairness */
+	for (fwp = &fb->fb_waiters; *fwp != NULL; fwp = &(*fwp)->fw_next) {
+		/* nothing */
+	}
+	fw.fw_next = NULL;
+	*fwp = &fw;
+
+	while (!fw.fw_woken) {
+		cv_wait(fb->fb_cv, fb->fb_lock);
+	}
+	lock_release(fb->fb_lock);
+	if (curproc->p_exiting) {
+		return EINTR;
+	}
+	return 0;
+}
+
+int
+sys_futex_wake(userptr_t uaddr, int n, int *retval)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter *fw, **fwp;
+	struct addrspace *as;
+	vaddr_t addr;
+	int woken;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0 || n < 0) {
+		return EINVAL;
+	}
+
+	as = curproc_getas();
+	addr = (vaddr_t)uaddr;
+	fb = futex_hash(as, addr);
+	woken = 0;
+
+	lock_acquire(fb->fb_lock);
+	fwp = &fb->fb_waiters;
+	while (*fwp != NULL && woken < n) {
+		fw = *fwp;
+		if (fw->fw_as == as && fw->fw_addr == addr) {
+			*fwp = fw->fw_next;
+			fw->fw_woken = true;
+			woken++;
+		}
+		else {
+			fwp = &fw->fw_next;
+		}
+	}
+	if (woken > 0) {
+		cv_broadcast(fb->fb_cv, fb->fb_lock);
+	}
+	lock_release(fb->fb_lock);
+
+	*retval = woken;
+	return 0;
+}
+
+/*
+ * Wake every thread of P that's in futex_wait; P is exiting. P's
+ * waiters could be in any bucket, so look in all of them.
+ */
+void
+futex_wakeproc(struct proc *p)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter *fw, **fwp;
+	bool woke;
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		fb = &futex_table[i];
+		woke = false;
+		lock_acquire(fb->fb_lock);
+		fwp = &fb->fb_waiters;
+		while (*fwp != NULL) {
+			fw = *fwp;
+			if (fw->fw_proc == p) {
+				*fwp = fw->fw_next;
+				fw->fw_woken = true;
+				woke = true;
+			}
+			else {
+				fwp = &fw->fw_next;
+			}
+		}
+		if (woke) {
+			cv_broadcast(fb->fb_cv, fb->fb_lock);
+		}
+		lock_release(fb->fb_lock);
+	}
+}
@@ -61,6 +61,7 @@
 #include <elf.h>
 #include <mips/tlb.h>
 #include <spl.h>
+#include <spinlock.h>
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -148,21 +149,194 @@ load_segment(struct addrspace *as, struct vnode *v,
 }
 
 /*
- * Load an ELF executable user program into the current address space.
+ * What load_elf needs from the headers of an executable: the entry
+ * point and the PT_LOAD segments. Real programs have two or three
+ * segments; we give up on anything with more than ELF_MAXSEGS.
+ */
+#define ELF_MAXSEGS	8
+
+struct elfseg {
+	off_t es_offset;
+	vaddr_t es_vaddr;
+	size_t es_memsz;
+	size_t es_filesz;
+	uint32_t es_flags;
+};
+
+struct elfinfo {
+	vaddr_t ei_entry;
+	unsigned ei_nsegs;
+	struct elfseg ei_segs[ELF_MAXSEGS];
+};
+
+/*
+ * Cache of parsed headers, so that running the same program again
+ * (sh, cat, ...) doesn't reread and recheck them. Entries are keyed
+ * by vnode and hold a reference to it, so the key can't be recycled
+ * for another file while cached. Each entry notes the vnode's write
+ * generation (see vnode_writegen) from before the headers were read;
+ * if the file has been written or truncated since, the entry is stale
+ * and gets dropped on lookup. When full, the least recently used
+ * entry is replaced.
  *
- * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ * Writes made behind our back (to an emufs file on the host, say)
+ * aren't seen. elfcache_flush lets go of everything, which unmount
+ * does first so cached vnodes don't keep a filesystem busy.
+ */
+#define ELFCACHE_SIZE	16
+
+struct elfcache_entry {
+	struct vnode *ec_vn;		/* NULL if the slot is empty */
+	unsigned ec_gen;
+	unsigned ec_lastuse;
+	struct elfinfo ec_info;
+};
+
+static struct spinlock elfcache_lock = SPINLOCK_INITIALIZER;
+static struct elfcache_entry elfcache[ELFCACHE_SIZE];
+static unsigned elfcache_clock;
+static unsigned elfcache_hits, elfcache_misses, elfcache_stale;
+
+/*
+ * Look V up in the cache; on a hit copy its headers to INFO.
  */
+static
+bool
+elfcache_lookup(struct vnode *v, struct elfinfo *info)
+{
+	struct elfcache_entry *ec;
+	struct vnode *drop = NULL;
+	bool found = false;
+	unsigned i;
+
+	spinlock_acquire(&elfcache_lock);
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		ec = &elfcache[i];
+		if (ec->ec_vn != v) {
+			continue;
+		}
+		if (ec->ec_gen == vnode_writegen(v)) {
+			ec->ec_lastuse = ++elfcache_clock;
+			*info = ec->ec_info;
+			found = true;
+		}
+		else {
+			ec->ec_vn = NULL;
+			drop = v;
+			elfcache_stale++;
+		}
+		break;
+	}
+	if (found) {
+		elfcache_hits++;
+	}
+	else {
+		elfcache_misses++;
+	}
+	spinlock_release(&elfcache_lock);
+
+	if (drop != NULL) {
+		VOP_DECREF(drop);
+	}
+	return found;
+}
+
+/*
+ * Remember INFO as the headers of V as of write generation GEN.
+ */
+static
+void
+elfcache_insert(struct vnode *v, unsigned gen, const struct elfinfo *info)
+{
+	struct elfcache_entry *ec, *victim = NULL;
+	struct vnode *drop;
+	unsigned i;
+
+	VOP_INCREF(v);
+
+	spinlock_acquire(&elfcache_lock);
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		ec = &elfcache[i];
+		if (ec->ec_vn == v) {
+			/* someone else filled it meanwhile */
+			victim = ec;
+			break;
+		}
+		/* otherwise prefer an empty slot, then the oldest */
+		if (victim == NULL ||
+		    (victim->ec_vn != NULL &&
+		     (ec->ec_vn == NULL ||
+		      ec->ec_lastuse < victim->ec_lastuse))) {
+			victim = ec;
+		}
+	}
+	drop = victim->ec_vn;
+	victim->ec_vn = v;
+	victim->ec_gen = gen;
+	victim->ec_lastuse = ++elfcache_clock;
+	victim->ec_info = *info;
+	spinlock_release(&elfcache_lock);
+
+	/* the entry's old vnode, or our extra reference if it was V */
+	if (drop != NULL) {
+		VOP_DECREF(drop);
+	}
+}
+
+/*
+ * Empty the cache, dropping its vnode references.
+ */
+void
+elfcache_flush(void)
+{
+	struct vnode *v;
+	unsigned i;
+
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		spinlock_acquire(&elfcache_lock);
+		v = elfcache[i].ec_vn;
+		elfcache[i].ec_vn = NULL;
+		spinlock_release(&elfcache_lock);
+		if (v != NULL) {
+			VOP_DECREF(v);
+		}
+	}
+}
+
+void
+elfcache_printstats(void)
+{
+	unsigned i, hits, misses, stale, used = 0;
+
+	spinlock_acquire(&elfcache_lock);
+	hits = elfcache_hits;
+	misses = elfcache_misses;
+	stale = elfcache_stale;
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		if (elfcache[i].ec_vn != NULL) {
+			used++;
+		}
+	}
+	spinlock_release(&elfcache_lock);
+
+	kprintf("elfcache: %u hits, %u misses (%u stale), %u/%u entries\n",
+		hits, misses, stale, used, ELFCACHE_SIZE);
+}
+
+/*
+ * Read and check the executable header and program headers of V,
+ * filling in INFO.
+ */
+static
 int
-load_elf(struct vnode *v, vaddr_t *entrypoint)
+elf_readheaders(struct vnode *v, struct elfinfo *info)
 {
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
+	struct elfseg *es;
 	int result, i;
 	struct iovec iov;
 	struct uio ku;
-	struct addrspace *as;
-
-	as = curproc_getas();
 
 	/*
 	 * Read the executable header from offset 0 in the file.
@@ -205,7 +379,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	/*
-	 * Go through the list of segments and set up the address space.
+	 * Go through the list of segments and note the ones to load.
 	 *
 	 * Ordinarily there will be one code segment, one read-only
 	 * data segment, and one data/bss segment, but there might
@@ -219,6 +393,8 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * to find where the phdr starts.
 	 */
 
+	info->ei_entry = eh.e_entry;
+	info->ei_nsegs = 0;
 	for (i=0; i<eh.e_phnum; i++) {
 		off_t offset = eh.e_phoff + i*eh.e_phentsize;
 		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
@@ -245,11 +421,59 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+		if (info->ei_nsegs == ELF_MAXSEGS) {
+			kprintf("loadelf: more than %d segments\n",
+				ELF_MAXSEGS);
+			return ENOEXEC;
+		}
+		es = &info->ei_segs[info->ei_nsegs++];
+		es->es_offset = ph.p_offset;
+		es->es_vaddr = ph.p_vaddr;
+		es->es_memsz = ph.p_memsz;
+		es->es_filesz = ph.p_filesz;
+		es->es_flags = ph.p_flags;
+	}
+
+	return 0;
+}
+
+/*
+ * Load an ELF executable user program into the current address space.
+ *
+ * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ */
+int
+load_elf(struct vnode *v, vaddr_t *entrypoint)
+{
+	struct elfinfo info;
+	struct elfseg *es;
+	struct addrspace *as;
+	unsigned gen, i;
+	int result;
+
+	as = curproc_getas();
+
+	if (!elfcache_lookup(v, &info)) {
+		/* take the generation first, so a write during the read shows */
+		gen = vnode_writegen(v);
+		result = elf_readheaders(v, &info);
+		if (result) {
+			return result;
+		}
+		elfcache_insert(v, gen, &info);
+	}
+
+	/*
+	 * Set up the address space.
+	 */
+
+	for (i=0; i<info.ei_nsegs; i++) {
+		es = &info.ei_segs[i];
 		result = as_define_region(as,
-					  ph.p_vaddr, ph.p_memsz,
-					  ph.p_flags & PF_R,
-					  ph.p_flags & PF_W,
-					  ph.p_flags & PF_X);
+					  es->es_vaddr, es->es_memsz,
+					  es->es_flags & PF_R,
+					  es->es_flags & PF_W,
+					  es->es_flags & PF_X);
 		if (result) {
 			return result;
 		}
@@ -264,35 +488,11 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * Now actually load each segment.
 	 */
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
-
-		result = VOP_READ(v, &ku);
-		if (result) {
-			return result;
-		}
-
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
-		}
-
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n", 
-				ph.p_type);
-			return ENOEXEC;
-		}
-
-		result = load_segment(as, v, ph.p_offset, ph.p_vaddr, 
-				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
+	for (i=0; i<info.ei_nsegs; i++) {
+		es = &info.ei_segs[i];
+		result = load_segment(as, v, es->es_offset, es->es_vaddr, 
+				      es->es_memsz, es->es_filesz,
+				      es->es_flags & PF_X);
 		if (result) {
 			return result;
 		}
@@ -312,7 +512,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		return result;
 	}
 
-	*entrypoint = eh.e_entry;
+	*entrypoint = info.ei_entry;
 
 	return 0;
 }
@@ -2,6 +2,8 @@
 #include <kern/errno.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <lib.h>
 #include <syscall.h>
 #include <current.h>
@@ -16,29 +18,123 @@
 #include <vfs.h>
 #include <kern/fcntl.h>
 #include <limits.h>
+#include <argbuf.h>
+#include <clock.h>
+
+/*
+ * Throw away the exit record of a child that's been waited for, or
+ * that has nobody to wait for it, and free its pid. lk must be held.
+ */
+static
+void
+process_reap(struct process *rec)
+{
+  KASSERT(lock_do_i_hold(lk));
+  KASSERT(rec->parent == NULL);
+  pidtable_remove(rec);
+  pid_free(rec->pid);
+  kfree(rec);
+}
 
+/*
+ * _exit ends the whole process. Mark it exiting and wake any of its
+ * threads that are waiting for something, so that they fail out of
+ * their system calls; uthread_checkexit then makes them leave on the
+ * way back to user mode, as it does threads that were running.
+ */
 void sys__exit(int exitcode) {
 
-  struct addrspace *as;
   struct proc *p = curproc;
 
+  lock_acquire(p->p_uthread_lock);
+  if (!p->p_exiting) {
+    p->p_exiting = true;
+    p->p_exitcode = exitcode;
+  }
+  cv_broadcast(p->p_uthread_cv, p->p_uthread_lock);
+  lock_release(p->p_uthread_lock);
+
+  futex_wakeproc(p);
   lock_acquire(lk);
+  cv_broadcast(p->p_childcv, lk);
+  lock_release(lk);
 
-  for (size_t i = 0; i < array_num(procTable); i++) {
-    struct process *p = array_get(procTable, i);
-    if (p->pid == curproc->pid) {
-      p->exited = 1;
-      p->exitcode = _MKWAIT_EXIT(exitcode);
-    }
+  DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
+
+  uthread_leave();
+}
+
+/*
+ * Called on every return to user mode, so it doesn't take the lock;
+ * p_exiting only ever goes from false to true, and a thread that
+ * misses it here sees it next time.
+ */
+void uthread_checkexit(void) {
+  if (curproc->p_exiting) {
+    uthread_leave();
   }
+}
 
-  cv_broadcast(cv, lk);
+/*
+ * The current thread leaves its process. Unless it is the last one
+ * that's all; the process runs on, and exits when its last thread
+ * does, with the status given to _exit or by the first thread's
+ * thread_exit (see sys_thread_exit).
+ *
+ * A thread that isn't last detaches itself before letting go of
+ * p_uthread_lock, so that by the time the last one gets it, it is the
+ * only thread left in p_threads for proc_destroy.
+ */
+void uthread_leave(void) {
 
-  lock_release(lk);
+  struct addrspace *as;
+  struct proc *p = curproc;
+  struct process *rec;
+  struct proc *parent;
+  struct threadusage usage;
+  int exitcode;
+
+  lock_acquire(p->p_uthread_lock);
+  KASSERT(p->p_nuthreads > 0);
+  p->p_nuthreads--;
+  if (p->p_nuthreads > 0) {
+    proc_remthread(curthread);
+    lock_release(p->p_uthread_lock);
+    thread_exit();
+  }
+  exitcode = p->p_exitcode;
+  lock_release(p->p_uthread_lock);
 
-  DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
+  /* what our parent gets to add to its children's usage */
+  proc_getusage(p, &usage, true);
+
+  lock_acquire(lk);
+  /* our children are orphans now; the ones that have exited go away */
+  while (p->p_zombies != NULL) {
+    rec = p->p_zombies;
+    process_remchild(rec);
+    process_reap(rec);
+  }
+  while (p->p_children != NULL) {
+    process_remchild(p->p_children);
+  }
+  rec = pidtable_lookup(p->pid);
+  KASSERT(rec != NULL);
+  rec->exited = true;
+  rec->exitcode = _MKWAIT_EXIT(exitcode);
+  rec->usage = usage;
+  parent = rec->parent;
+  if (parent == NULL) {
+    /* nobody will wait for us */
+    process_reap(rec);
+  }
+  else {
+    process_remchild(rec);
+    process_addchild(parent, rec);
+    cv_broadcast(parent->p_childcv, lk);
+  }
+  lock_release(lk);
 
-  KASSERT(curproc->p_addrspace != NULL);
   as_deactivate();
   /*
    * clear p_addrspace before calling as_destroy. Otherwise if
@@ -48,7 +144,14 @@ void sys__exit(int exitcode) {
    * messily fatal.
    */
   as = curproc_setas(NULL);
-  as_destroy(as);
+  /*
+   * Our parent has been told; free our memory in the background,
+   * unless we're a vforked child and it's really our parent's. (It
+   * can be NULL if we failed to start; see spawn_start.)
+   */
+  if (!vfork_done(as) && as != NULL) {
+    reaper_add(as);
+  }
 
   /* detach this thread from its process */
   /* note: curproc cannot be used after this call */
@@ -60,7 +163,7 @@ void sys__exit(int exitcode) {
   
   thread_exit();
   /* thread_exit() does not return, so we should never get here */
-  panic("return from thread_exit in sys_exit\n");
+  panic("return from thread_exit in uthread_leave\n");
 }
 
 
@@ -72,61 +175,168 @@ sys_getpid(pid_t *retval)
   return(0);
 }
 
-/* stub handler for waitpid() system call                */
+/*
+ * Copy resource usage out to user space as a struct rusage.
+ */
+static
+int
+usage_copyout(const struct threadusage *tu, userptr_t uru)
+{
+  struct rusage ru;
+
+  bzero(&ru, sizeof(ru));
+  ru.ru_utime.tv_sec = tu->tu_uticks / HZ;
+  ru.ru_utime.tv_usec = (tu->tu_uticks % HZ) * (1000000 / HZ);
+  ru.ru_stime.tv_sec = tu->tu_sticks / HZ;
+  ru.ru_stime.tv_usec = (tu->tu_sticks % HZ) * (1000000 / HZ);
+  ru.ru_minflt = tu->tu_faults;
+  ru.ru_nvcsw = tu->tu_nvcsw;
+  ru.ru_nivcsw = tu->tu_nivcsw;
+  ru.ru_inbytes = tu->tu_inbytes;
+  ru.ru_outbytes = tu->tu_outbytes;
+  return(copyout(&ru, uru, sizeof(ru)));
+}
+
+/* waitpid() is wait4() without the usage */
 int
 sys_waitpid(pid_t pid,
 	    userptr_t status,
 	    int options,
 	    pid_t *retval)
 {
+  return(sys_wait4(pid, status, options, NULL, retval));
+}
+
+int
+sys_wait4(pid_t pid,
+          userptr_t status,
+          int options,
+          userptr_t rusage,
+          pid_t *retval)
+{
 
   int exitstatus;
   int result;
+  struct process *rec;
+  struct threadusage usage;
 
-  /* this is just a stub implementation that always reports an
-     exit status of 0, regardless of the actual exit status of
-     the specified process.   
-     In fact, this will return 0 even if the specified process
-     is still running, and even if it never existed in the first place.
-
-     Fix this!
-  */
+  /*
+   * Wait for the given child, or with pid -1 for any child, to exit.
+   * Children that have exited are on p_zombies, so either way we only
+   * look at one record; and since each process has its own p_childcv,
+   * a child's exit wakes only its own parent. With WNOHANG, return 0
+   * if there's nothing to collect yet.
+   */
 
-  if (options != 0) {
+  if ((options & ~WNOHANG) != 0) {
     return(EINVAL);
   }
 
   lock_acquire(lk);
-
-  bool found = false;
-  for (size_t i = 0; i < array_num(procTable); i++) {
-    struct process *p = array_get(procTable, i);
-    if (p->pid == pid && p->parent == curproc) {
-      if (p->exited) {
-        exitstatus = p->exitcode;
-        found = true;
-        kfree(p);
-        array_remove(procTable, i);
-      } else {
-        cv_wait(cv, lk);
-        i = -1;
+  while (1) {
+    if (pid == WAIT_ANY) {
+      rec = curproc->p_zombies;
+      if (rec == NULL && curproc->p_children == NULL) {
+        lock_release(lk);
+        return(ECHILD);
+      }
+    }
+    else {
+      rec = pidtable_lookup(pid);
+      if (rec == NULL || rec->parent != curproc) {
+        lock_release(lk);
+        return(ECHILD);
       }
+      if (!rec->exited) {
+        rec = NULL;
+      }
+    }
+    if (rec != NULL) {
+      break;
+    }
+    if (options & WNOHANG) {
+      lock_release(lk);
+      *retval = 0;
+      return(0);
     }
+    if (curproc->p_exiting) {
+      /* another of our threads called _exit */
+      lock_release(lk);
+      return(EINTR);
+    }
+    cv_wait(curproc->p_childcv, lk);
   }
-  KASSERT(found);
-
+  pid = rec->pid;
+  exitstatus = rec->exitcode;
+  usage = rec->usage;
+  process_remchild(rec);
+  process_reap(rec);
   lock_release(lk);
 
-  result = copyout((void *)&exitstatus,status,sizeof(int));
-  if (result) {
-    return(result);
+  spinlock_acquire(&curproc->p_lock);
+  threadusage_add(&curproc->p_childusage, &usage);
+  spinlock_release(&curproc->p_lock);
+
+  if (status != NULL) {
+    result = copyout((void *)&exitstatus,status,sizeof(int));
+    if (result) {
+      return(result);
+    }
+  }
+  if (rusage != NULL) {
+    result = usage_copyout(&usage, rusage);
+    if (result) {
+      return(result);
+    }
   }
   *retval = pid;
 
   return(0);
 }
 
+/*
+ * Resource usage of this process, or of the children it has waited
+ * for (and, recursively, the ones they waited for).
+ */
+int
+sys_getrusage(int who, userptr_t rusage)
+{
+  struct proc *p = curproc;
+  struct threadusage usage;
+
+  if (who == RUSAGE_SELF) {
+    proc_getusage(p, &usage, false);
+  }
+  else if (who == RUSAGE_CHILDREN) {
+    spinlock_acquire(&p->p_lock);
+    usage = p->p_childusage;
+    spinlock_release(&p->p_lock);
+  }
+  else {
+    return(EINVAL);
+  }
+  return(usage_copyout(&usage, rusage));
+}
+
 #if OPT_A2
+/*
+ * Undo proc_create_runprogram for a child fork couldn't start.
+ */
+static
+void
+fork_abort(struct proc *child)
+{
+  struct process *rec;
+
+  lock_acquire(lk);
+  rec = pidtable_lookup(child->pid);
+  KASSERT(rec != NULL);
+  process_remchild(rec);
+  process_reap(rec);
+  lock_release(lk);
+  proc_destroy(child);
+}
+
 int sys_fork(struct trapframe *tf, pid_t *retval) {
   struct proc *child = proc_create_runprogram(curproc->p_name);
   if (child == NULL) {
@@ -134,126 +344,329 @@ int sys_fork(struct trapframe *tf, pid_t *retval) {
   }
   struct addrspace *as;
   int ret = as_copy(curproc->p_addrspace, &as);
-  if (ret != 0) return ret;
+  if (ret != 0) {
+    fork_abort(child);
+    return ret;
+  }
 
   spinlock_acquire(&child->p_lock);
   child->p_addrspace = as;
   spinlock_release(&child->p_lock);
 
-  struct process *p = kmalloc(sizeof(struct process));
-  p->pid = child->pid;
-  p->exited = 0;
-  p->parent = curproc;
-  unsigned r;
-
-  lock_acquire(lk);
-  array_add(procTable, p, &r);
-  lock_release(lk);
-
   struct trapframe *ctf = kmalloc(sizeof(struct trapframe));
+  if (ctf == NULL) {
+    as_destroy(as);
+    fork_abort(child);
+    return ENOMEM;
+  }
   *ctf = *tf;
 
-  thread_fork(child->p_name, child, enter_forked_process, ctf, 0);
+  ret = thread_fork(child->p_name, child, enter_forked_process, ctf, 0);
+  if (ret != 0) {
+    kfree(ctf);
+    as_destroy(as);
+    fork_abort(child);
+    return ret;
+  }
 
   *retval = child->pid;
 
   return 0;
 }
 
-int sys_execv(userptr_t progname, userptr_t args) {
-  // Copy program name into kernel
-  char *progn = kmalloc(strlen((char*)progname)+1);
-  strcpy(progn, (char*)progname);
+/*
+ * vfork: like fork, but the child borrows our address space instead
+ * of getting a copy, and we wait until it calls execv or _exit and
+ * so gives it back. The child must do nothing else in the meantime.
+ */
+int sys_vfork(struct trapframe *tf, pid_t *retval) {
+  struct vforkwait vw;
+  struct trapframe *ctf;
+  struct proc *child;
+  pid_t pid;
+  int result;
+
+  child = proc_create_runprogram(curproc->p_name);
+  if (child == NULL) {
+    return(EMPROC);
+  }
+  pid = child->pid;
 
-  // Count number of arguments
-  int nargs = 0;
-  while (((char**)args)[nargs] != NULL) {
-    nargs++;
+  vw.vw_sem = sem_create("vfork", 0);
+  if (vw.vw_sem == NULL) {
+    fork_abort(child);
+    return ENOMEM;
   }
+  vw.vw_as = curproc_getas();
 
-  // Copy arguments into kernel
-  char **a = kmalloc((nargs+1)*sizeof(*a));
-  for (int i = 0; i < nargs; i++) {
-    char *s = kmalloc(strlen(((char**)args)[i])+1);
-    strcpy(s, ((char**)args)[i]);
-    a[i] = s;
+  ctf = kmalloc(sizeof(*ctf));
+  if (ctf == NULL) {
+    sem_destroy(vw.vw_sem);
+    fork_abort(child);
+    return ENOMEM;
   }
-  a[nargs] = NULL;
+  *ctf = *tf;
 
+  spinlock_acquire(&child->p_lock);
+  child->p_addrspace = vw.vw_as;
+  spinlock_release(&child->p_lock);
+  child->p_vfork = &vw;
+
+  result = thread_fork(child->p_name, child, enter_forked_process, ctf, 0);
+  if (result) {
+    kfree(ctf);
+    child->p_addrspace = NULL;
+    child->p_vfork = NULL;
+    sem_destroy(vw.vw_sem);
+    fork_abort(child);
+    return result;
+  }
+
+  /* the child may be gone by the time we wake up */
+  P(vw.vw_sem);
+  sem_destroy(vw.vw_sem);
+
+  *retval = pid;
+  return 0;
+}
+
+bool vfork_done(struct addrspace *as) {
+  struct proc *p = curproc;
+  struct vforkwait *vw;
+  bool borrowed;
+
+  vw = p->p_vfork;
+  if (vw == NULL) {
+    return false;
+  }
+  p->p_vfork = NULL;
+  borrowed = (as == vw->vw_as);
+  /* vw is on our parent's stack, and goes away once it wakes */
+  V(vw->vw_sem);
+  return borrowed;
+}
+
+/*
+ * spawn: start a new process running a program, without copying or
+ * borrowing ours. The parent copies in the path and arguments and
+ * waits while the child loads the program into a fresh address
+ * space, so that errors (such as a bad path) come back from spawn.
+ */
+struct spawninfo {
+  char *si_path;
+  struct argbuf si_args;
+  struct semaphore *si_done;
+  int si_result;
+};
+
+static
+void
+spawn_start(void *data, unsigned long unused)
+{
+  struct spawninfo *si = data;
+  struct addrspace *as;
+  struct vnode *v;
+  vaddr_t entrypoint, stackptr;
+  userptr_t argv;
+  int argc, result;
+
+  (void)unused;
+
+  as = as_create();
+  if (as == NULL) {
+    result = ENOMEM;
+    goto done;
+  }
+  curproc_setas(as);
+  as_activate();
+
+  result = vfs_open(si->si_path, O_RDONLY, 0, &v);
+  if (result) {
+    goto done;
+  }
+  result = load_elf(v, &entrypoint);
+  vfs_close(v);
+  if (result) {
+    goto done;
+  }
+  result = as_define_stack(as, &stackptr);
+  if (result) {
+    goto done;
+  }
+  argc = si->si_args.ab_nargs;
+  result = argbuf_copyout(&si->si_args, &stackptr, &argv);
+
+ done:
+  si->si_result = result;
+  /* si is on our parent's stack, and goes away once it wakes */
+  V(si->si_done);
+  if (result) {
+    /* the parent collects us */
+    sys__exit(1);
+  }
+
+  enter_new_process(argc, argv, stackptr, entrypoint);
+  panic("enter_new_process returned\n");
+}
+
+int sys___spawn(userptr_t path, userptr_t argv, pid_t *retval) {
+  struct spawninfo si;
+  struct proc *child;
+  pid_t pid, junk;
+  int result;
+
+  si.si_path = kmalloc(PATH_MAX);
+  if (si.si_path == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr(path, si.si_path, PATH_MAX, NULL);
+  if (result) {
+    kfree(si.si_path);
+    return result;
+  }
+  result = argbuf_copyin(&si.si_args, argv);
+  if (result) {
+    kfree(si.si_path);
+    return result;
+  }
+  si.si_done = sem_create("spawn", 0);
+  if (si.si_done == NULL) {
+    result = ENOMEM;
+    goto fail;
+  }
+
+  child = proc_create_runprogram(si.si_path);
+  if (child == NULL) {
+    result = EMPROC;
+    goto fail;
+  }
+  pid = child->pid;
+
+  result = thread_fork(child->p_name, child, spawn_start, &si, 0);
+  if (result) {
+    fork_abort(child);
+    goto fail;
+  }
+
+  P(si.si_done);
+  result = si.si_result;
+  if (result) {
+    /* it's exiting; collect it so the pid isn't left behind */
+    sys_waitpid(pid, NULL, 0, &junk);
+    goto fail;
+  }
+
+  sem_destroy(si.si_done);
+  argbuf_cleanup(&si.si_args);
+  kfree(si.si_path);
+  *retval = pid;
+  return 0;
+
+ fail:
+  if (si.si_done != NULL) {
+    sem_destroy(si.si_done);
+  }
+  argbuf_cleanup(&si.si_args);
+  kfree(si.si_path);
+  return result;
+}
+
+/*
+ * execv: replace the current program. The path and arguments are
+ * copied in before anything else is done, so that a bad pointer or
+ * an oversize argument list fails with nothing changed; likewise,
+ * until the new program is completely loaded the old address space
+ * stays around, and we go back to it if anything goes wrong.
+ */
+int sys_execv(userptr_t progname, userptr_t args) {
   struct addrspace *as, *oldas;
-	struct vnode *v;
-	vaddr_t entrypoint, stackptr;
-	int result;
-
-	/* Open the file. */
-	result = vfs_open(progn, O_RDONLY, 0, &v);
-	if (result) {
-		return result;
-	}
-
-  /* If execv was called, get old address space to delete later */
-  oldas = curproc_getas();
-
-	/* Create a new address space. */
-	as = as_create();
-	if (as == NULL) {
-		vfs_close(v);
-		return ENOMEM;
-	}
-
-	/* Switch to it and activate it. */
-	curproc_setas(as);
-	as_activate();
-
-	/* Load the executable. */
-	result = load_elf(v, &entrypoint);
-	if (result) {
-		/* p_addrspace will go away when curproc is destroyed */
-		vfs_close(v);
-		return result;
-	}
-
-	/* Done with the file now. */
-	vfs_close(v);
-
-	/* Define the user stack in the address space */
-	result = as_define_stack(as, &stackptr);
-	if (result) {
-		/* p_addrspace will go away when curproc is destroyed */
-		return result;
-	}
-
-  /* Copy arguments into new address space */
-  int argoffset[nargs];
-  int sizeargs = 0;
-  for (int i = 0; i < nargs; i++) {
-    sizeargs += ROUNDUP(strlen(a[i])+1, 8);
-    copyoutstr(a[i], (userptr_t)stackptr - sizeargs, strlen(a[i])+1, NULL);
-    argoffset[i] = sizeargs;
-    kfree(a[i]);
-  }
-  if (sizeargs > ARG_MAX) {
-    return E2BIG;
-  }
-
-  userptr_t argv = (userptr_t)stackptr;
-  argv = argv - sizeargs - 4*(nargs+1);
-
-  for (int i = 0; i < nargs; i++) {
-    ((char**)argv)[i] = (char*)stackptr - argoffset[i];
-  }
-  ((char**)argv)[nargs] = NULL;
-
-  /* Delete old address space */
-  as_destroy(oldas);
-
-	/* Warp to user mode. */
-	enter_new_process(nargs /*argc*/, argv /*userspace addr of argv*/,
-			  (vaddr_t) argv, entrypoint);
-
-	/* enter_new_process does not return. */
-	panic("enter_new_process returned\n");
-	return EINVAL;
+  struct argbuf ab;
+  struct vnode *v;
+  vaddr_t entrypoint, stackptr;
+  userptr_t argv;
+  char *progn;
+  int argc, result;
+  bool alone;
+
+  /*
+   * Other threads would be left running in the address space we're
+   * about to swap out and free. p_nuthreads counts live threads, not
+   * records waiting for thread_join: a thread that has exited is off
+   * it already, its stack is gone, and its record holds no pointers
+   * into the address space, so it doesn't stop us. Only a running
+   * thread can start another, so if we're the only one we stay that
+   * way.
+   */
+  lock_acquire(curproc->p_uthread_lock);
+  alone = (curproc->p_nuthreads == 1);
+  lock_release(curproc->p_uthread_lock);
+  if (!alone) {
+    return EBUSY;
+  }
+
+  progn = kmalloc(PATH_MAX);
+  if (progn == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr(progname, progn, PATH_MAX, NULL);
+  if (result) {
+    kfree(progn);
+    return result;
+  }
+  result = argbuf_copyin(&ab, args);
+  if (result) {
+    kfree(progn);
+    return result;
+  }
+
+  /* Open the file. */
+  result = vfs_open(progn, O_RDONLY, 0, &v);
+  kfree(progn);
+  if (result) {
+    argbuf_cleanup(&ab);
+    return result;
+  }
+
+  /* Create a new address space, and switch to it. */
+  as = as_create();
+  if (as == NULL) {
+    vfs_close(v);
+    argbuf_cleanup(&ab);
+    return ENOMEM;
+  }
+  oldas = curproc_setas(as);
+  as_activate();
+
+  /* Load the executable, and set up its stack and arguments. */
+  result = load_elf(v, &entrypoint);
+  vfs_close(v);
+  if (result == 0) {
+    result = as_define_stack(as, &stackptr);
+  }
+  if (result == 0) {
+    argc = ab.ab_nargs;
+    result = argbuf_copyout(&ab, &stackptr, &argv);
+  }
+  argbuf_cleanup(&ab);
+  if (result) {
+    /* Go back to the old program. */
+    curproc_setas(oldas);
+    as_activate();
+    as_destroy(as);
+    return result;
+  }
+
+  /* Delete old address space, or give it back if it was borrowed */
+  if (!vfork_done(oldas)) {
+    reaper_add(oldas);
+  }
+
+  /* Warp to user mode. */
+  enter_new_process(argc, argv, stackptr, entrypoint);
+
+  /* enter_new_process does not return. */
+  panic("enter_new_process returned\n");
+  return EINVAL;
 }
 
 #endif /* OPT_A2 */
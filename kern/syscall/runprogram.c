@@ -46,6 +46,7 @@
 #include <test.h>
 #include <copyinout.h>
 #include <limits.h>
+#include <argbuf.h>
 
 /*
  * Load program "progname" and start running it in usermode.
@@ -58,22 +59,32 @@ runprogram(char *progname, char **args, int nargs)
 {
 	struct addrspace *as;
 	struct vnode *v;
+	struct argbuf ab;
 	vaddr_t entrypoint, stackptr;
+	userptr_t argv;
 	int result;
 
+	/* Gather up the arguments */
+	result = argbuf_fromkernel(&ab, args, nargs);
+	if (result) {
+		return result;
+	}
+
 	/* Open the file. */
 	result = vfs_open(progname, O_RDONLY, 0, &v);
 	if (result) {
+		argbuf_cleanup(&ab);
 		return result;
 	}
 
-  /* If execv wasn't called, we should be a new process. */
-  KASSERT(curproc_getas() == NULL);
+	/* We should be a new process. */
+	KASSERT(curproc_getas() == NULL);
 
 	/* Create a new address space. */
 	as = as_create();
 	if (as == NULL) {
 		vfs_close(v);
+		argbuf_cleanup(&ab);
 		return ENOMEM;
 	}
 
@@ -86,6 +97,7 @@ runprogram(char *progname, char **args, int nargs)
 	if (result) {
 		/* p_addrspace will go away when curproc is destroyed */
 		vfs_close(v);
+		argbuf_cleanup(&ab);
 		return result;
 	}
 
@@ -96,35 +108,22 @@ runprogram(char *progname, char **args, int nargs)
 	result = as_define_stack(as, &stackptr);
 	if (result) {
 		/* p_addrspace will go away when curproc is destroyed */
+		argbuf_cleanup(&ab);
 		return result;
 	}
 
-  /* Copy arguments into new address space */
-  int argoffset[nargs];
-  int sizeargs = 0;
-  for (int i = 0; i < nargs; i++) {
-    sizeargs += ROUNDUP(strlen(args[i])+1, 8);
-    copyoutstr(args[i], (userptr_t)stackptr - sizeargs, strlen(args[i])+1, NULL);
-    argoffset[i] = sizeargs;
-  }
-  if (sizeargs > ARG_MAX) {
-    return E2BIG;
-  }
-
-  userptr_t argv = (userptr_t)stackptr;
-  argv = argv - sizeargs - 4*(nargs+1);
-
-  for (int i = 0; i < nargs; i++) {
-    ((char**)argv)[i] = (char*)stackptr - argoffset[i];
-  }
-  ((char**)argv)[nargs] = NULL;
+	/* Copy the arguments onto it */
+	result = argbuf_copyout(&ab, &stackptr, &argv);
+	argbuf_cleanup(&ab);
+	if (result) {
+		return result;
+	}
 
 	/* Warp to user mode. */
 	enter_new_process(nargs /*argc*/, argv /*userspace addr of argv*/,
-			  (vaddr_t) argv, entrypoint);
+			  stackptr, entrypoint);
 	
 	/* enter_new_process does not return. */
 	panic("enter_new_process returned\n");
 	return EINVAL;
 }
-
@@ -0,0 +1,250 @@
+/*
+ * System call profiler. See syscallstats.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <spl.h>
+#include <thread.h>
+#include <syscall.h>
+#include <syscallstats.h>
+
+#if OPT_SYSCALLSTATS
+
+struct syscallstat {
+	unsigned ss_calls;		/* entries */
+	unsigned ss_returns;		/* returns; these are timed */
+	uint64_t ss_totalns;
+	uint64_t ss_maxns;
+	unsigned ss_hist[SYSCALLSTATS_NBUCKETS];
+};
+
+/* SYSCALL_NCALLS entries for each cpu in turn */
+static struct syscallstat *syscallstats;
+static unsigned syscallstats_ncpus;
+
+void
+syscallstats_bootstrap(void)
+{
+	size_t size;
+
+	syscallstats_ncpus = thread_numcpus();
+	size = syscallstats_ncpus * SYSCALL_NCALLS * sizeof(*syscallstats);
+	syscallstats = kmalloc(size);
+	if (syscallstats == NULL) {
+		panic("syscallstats_bootstrap: out of memory\n");
+	}
+	bzero(syscallstats, size);
+}
+
+static
+struct syscallstat *
+syscallstats_get(unsigned cpunum, int callno)
+{
+	return &syscallstats[cpunum * SYSCALL_NCALLS + callno];
+}
+
+/*
+ * The bucket for a call that took NS ns: floor(log2(NS)), with 0 and
+ * 1 both in bucket 0 and everything past the end in the last bucket.
+ */
+static
+unsigned
+syscallstats_bucket(uint64_t ns)
+{
+	unsigned b = 0;
+
+	if (ns >> SYSCALLSTATS_NBUCKETS) {
+		return SYSCALLSTATS_NBUCKETS - 1;
+	}
+	while (ns >> (b + 1)) {
+		b++;
+	}
+	return b;
+}
+
+void
+syscallstats_enter(int callno)
+{
+	int spl;
+
+	if (syscallstats == NULL || callno < 0 || callno >= SYSCALL_NCALLS) {
+		return;
+	}
+	/* splhigh keeps us on this cpu and off its other threads' toes */
+	spl = splhigh();
+	syscallstats_get(curcpu->c_number, callno)->ss_calls++;
+	splx(spl);
+}
+
+void
+syscallstats_exit(int callno, uint64_t ns)
+{
+	struct syscallstat *ss;
+	int spl;
+
+	if (syscallstats == NULL || callno < 0 || callno >= SYSCALL_NCALLS) {
+		return;
+	}
+	spl = splhigh();
+	ss = syscallstats_get(curcpu->c_number, callno);
+	ss->ss_returns++;
+	ss->ss_totalns += ns;
+	if (ns > ss->ss_maxns) {
+		ss->ss_maxns = ns;
+	}
+	ss->ss_hist[syscallstats_bucket(ns)]++;
+	splx(spl);
+}
+
+void
+syscallstats_reset(void)
+{
+	if (syscallstats == NULL) {
+		return;
+	}
+	/* a call finishing meanwhile on another cpu may survive; no matter */
+	bzero(syscallstats, syscallstats_ncpus * SYSCALL_NCALLS *
+	      sizeof(*syscallstats));
+}
+
+/*
+ * Add up the counts for CALLNO from all the cpus.
+ */
+static
+void
+syscallstats_sum(int callno, struct syscallstat *sum)
+{
+	struct syscallstat *ss;
+	unsigned i, b;
+
+	bzero(sum, sizeof(*sum));
+	for (i=0; i<syscallstats_ncpus; i++) {
+		ss = syscallstats_get(i, callno);
+		sum->ss_calls += ss->ss_calls;
+		sum->ss_returns += ss->ss_returns;
+		sum->ss_totalns += ss->ss_totalns;
+		if (ss->ss_maxns > sum->ss_maxns) {
+			sum->ss_maxns = ss->ss_maxns;
+		}
+		for (b=0; b<SYSCALLSTATS_NBUCKETS; b++) {
+			sum->ss_hist[b] += ss->ss_hist[b];
+		}
+	}
+}
+
+static
+void
+syscallstats_printhist(int callno)
+{
+	struct syscallstat sum;
+	unsigned b, lo;
+
+	syscallstats_sum(callno, &sum);
+	kprintf("%s: %u calls, %u returned, %lu us total, %lu us max\n",
+		syscall_name(callno), sum.ss_calls, sum.ss_returns,
+		(unsigned long)(sum.ss_totalns / 1000),
+		(unsigned long)(sum.ss_maxns / 1000));
+	for (b=0; b<SYSCALLSTATS_NBUCKETS; b++) {
+		if (sum.ss_hist[b] == 0) {
+			continue;
+		}
+		lo = (b == 0) ? 0 : 1U << b;
+		if (b == SYSCALLSTATS_NBUCKETS - 1) {
+			kprintf("  %10u ns and up      %9u\n", lo,
+				sum.ss_hist[b]);
+		}
+		else {
+			kprintf("  %10u - %10u ns %9u\n", lo, (2U << b) - 1,
+				sum.ss_hist[b]);
+		}
+	}
+}
+
+void
+syscallstats_print(unsigned topn, const char *name)
+{
+	struct syscallstat sum, bestsum;
+	uint64_t prevtotal = 0;
+	int callno, best, prev;
+	unsigned i;
+
+	if (syscallstats == NULL) {
+		kprintf("syscallstats not started yet\n");
+		return;
+	}
+
+	if (name != NULL) {
+		for (callno=0; callno<SYSCALL_NCALLS; callno++) {
+			if (syscall_name(callno) != NULL &&
+			    !strcmp(syscall_name(callno), name)) {
+				syscallstats_printhist(callno);
+				return;
+			}
+		}
+		kprintf("syscallstats: no system call %s\n", name);
+		return;
+	}
+
+	/*
+	 * Pick out the calls in order of total time, ties going by
+	 * call number; there aren't enough calls for this to be slow.
+	 */
+	kprintf("%-16s %9s %9s %10s %10s %10s\n", "call", "calls",
+		"returned", "total_us", "avg_us", "max_us");
+	prev = -1;
+	for (i=0; i<topn; i++) {
+		best = -1;
+		bzero(&bestsum, sizeof(bestsum));
+		for (callno=0; callno<SYSCALL_NCALLS; callno++) {
+			syscallstats_sum(callno, &sum);
+			if (sum.ss_calls == 0) {
+				continue;
+			}
+			if (prev >= 0 &&
+			    (sum.ss_totalns > prevtotal ||
+			     (sum.ss_totalns == prevtotal &&
+			      callno <= prev))) {
+				continue;
+			}
+			if (best < 0 || sum.ss_totalns > bestsum.ss_totalns) {
+				best = callno;
+				bestsum = sum;
+			}
+		}
+		if (best < 0) {
+			break;
+		}
+		kprintf("%-16s %9u %9u %10lu %10lu %10lu\n",
+			syscall_name(best) ? syscall_name(best) : "?",
+			bestsum.ss_calls, bestsum.ss_returns,
+			(unsigned long)(bestsum.ss_totalns / 1000),
+			bestsum.ss_returns == 0 ? 0UL :
+			(unsigned long)(bestsum.ss_totalns / 1000 /
+					bestsum.ss_returns),
+			(unsigned long)(bestsum.ss_maxns / 1000));
+		prev = best;
+		prevtotal = bestsum.ss_totalns;
+	}
+}
+
+#else /* !OPT_SYSCALLSTATS */
+
+void
+syscallstats_reset(void)
+{
+	kprintf("syscallstats not compiled in (options syscallstats)\n");
+}
+
+void
+syscallstats_print(unsigned topn, const char *name)
+{
+	(void)topn;
+	(void)name;
+	kprintf("syscallstats not compiled in (options syscallstats)\n");
+}
+
+#endif /* OPT_SYSCALLSTATS */
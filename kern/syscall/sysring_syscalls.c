@@ -0,0 +1,122 @@
+/*
+ * System call ring: carry out a batch of system calls queued in user
+ * memory in one trap. See <kern/sysring.h> for the layout and rules.
+ *
+ * Entries are copied in SYSRING_BATCH at a time, run, and copied back
+ * out with their results, so a batch costs two copyins and two
+ * copyouts per SYSRING_BATCH entries instead of a trap per call. Only
+ * calls that take plain values and return one int can go in the
+ * ring, and none that don't return (_exit) or that replace the caller
+ * (execv) or copy it (fork).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/syscall.h>
+#include <kern/sysring.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+/* entries handled per copyin; they live on the kernel stack */
+#define SYSRING_BATCH	16
+
+/*
+ * Run one entry, leaving the outcome in it.
+ */
+static
+void
+sysring_run(struct sysring_entry *se)
+{
+	pid_t pid;
+	int err;
+
+	se->se_result = 0;
+	switch (se->se_op) {
+	    case SYS_write:
+		err = sys_write((int)se->se_arg[0], (userptr_t)se->se_arg[1],
+				se->se_arg[2], &se->se_result);
+		break;
+	    case SYS_getpid:
+		err = sys_getpid(&pid);
+		se->se_result = pid;
+		break;
+	    default:
+		err = ENOSYS;
+		break;
+	}
+	se->se_error = err;
+	if (err) {
+		se->se_result = -1;
+	}
+}
+
+int
+sys_sysring_enter(userptr_t uring, unsigned n, int *retval)
+{
+	struct sysring_entry batch[SYSRING_BATCH];
+	struct sysring ring;
+	userptr_t uentry;
+	unsigned pending, done, slot, count, i;
+	int result;
+
+	result = copyin(uring, &ring, sizeof(ring));
+	if (result) {
+		return result;
+	}
+	if (ring.sr_size == 0 || ring.sr_size > SYSRING_MAXSIZE ||
+	    (ring.sr_size & (ring.sr_size - 1)) != 0) {
+		return EINVAL;
+	}
+	pending = ring.sr_head - ring.sr_tail;
+	if (pending > ring.sr_size) {
+		return EINVAL;
+	}
+	if (n > pending) {
+		n = pending;
+	}
+
+	/*
+	 * Go in runs that stop at the end of the array. If copying
+	 * fails partway, report what got done; the next call will
+	 * hit the same error straight off and return it.
+	 */
+	done = 0;
+	while (done < n) {
+		slot = (ring.sr_tail + done) & (ring.sr_size - 1);
+		count = n - done;
+		if (count > SYSRING_BATCH) {
+			count = SYSRING_BATCH;
+		}
+		if (count > ring.sr_size - slot) {
+			count = ring.sr_size - slot;
+		}
+		uentry = (userptr_t)(ring.sr_entries + slot);
+
+		result = copyin(uentry, batch, count * sizeof(batch[0]));
+		if (result) {
+			break;
+		}
+		for (i=0; i<count; i++) {
+			sysring_run(&batch[i]);
+		}
+		result = copyout(batch, uentry, count * sizeof(batch[0]));
+		done += count;
+		if (result) {
+			break;
+		}
+	}
+	if (done == 0 && result) {
+		return result;
+	}
+
+	ring.sr_tail += done;
+	result = copyout(&ring.sr_tail,
+			 (userptr_t)&((struct sysring *)uring)->sr_tail,
+			 sizeof(ring.sr_tail));
+	if (result) {
+		return result;
+	}
+	*retval = done;
+	return 0;
+}
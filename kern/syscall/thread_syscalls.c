@@ -0,0 +1,181 @@
+/*
+ * User thread system calls.
+ *
+ * __thread_create starts another thread in the current process, on a
+ * stack of its own from as_define_threadstack, at a user entry point
+ * that gets two arguments; libc uses it to call the thread function
+ * and then thread_exit. thread_exit ends the calling thread, keeping
+ * its return value for thread_join. A process lasts until its last
+ * thread exits, or until one calls _exit, which makes the rest leave;
+ * see uthread_leave.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <thread.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+/*
+ * First thing a new user thread does: note which thread it is, so
+ * thread_exit can find its record, and go to user mode.
+ */
+static
+void
+uthread_start(void *data, unsigned long unused)
+{
+	struct uthread *ut = data;
+	struct proc *p = curproc;
+
+	(void)unused;
+
+	lock_acquire(p->p_uthread_lock);
+	ut->ut_thread = curthread;
+	lock_release(p->p_uthread_lock);
+
+	/* _exit may have been called since we were created */
+	uthread_checkexit();
+
+	enter_new_process((int)ut->ut_func, ut->ut_arg, ut->ut_stackptr,
+			  ut->ut_entry);
+	panic("enter_new_process returned\n");
+}
+
+int
+sys___thread_create(userptr_t entry, userptr_t func, userptr_t arg,
+		    int *retval)
+{
+	struct proc *p = curproc;
+	struct uthread *ut, **utp;
+	int result;
+
+	ut = kmalloc(sizeof(*ut));
+	if (ut == NULL) {
+		return ENOMEM;
+	}
+	result = as_define_threadstack(curproc_getas(), &ut->ut_stackslot,
+				       &ut->ut_stackptr);
+	if (result) {
+		kfree(ut);
+		return result;
+	}
+	ut->ut_thread = NULL;
+	ut->ut_entry = (vaddr_t)entry;
+	ut->ut_func = func;
+	ut->ut_arg = arg;
+	ut->ut_exited = false;
+	ut->ut_retval = NULL;
+
+	lock_acquire(p->p_uthread_lock);
+	ut->ut_tid = p->p_nexttid++;
+	ut->ut_next = p->p_uthreads;
+	p->p_uthreads = ut;
+	p->p_nuthreads++;
+	*retval = ut->ut_tid;
+	lock_release(p->p_uthread_lock);
+
+	result = thread_fork(p->p_name, p, uthread_start, ut, 0);
+	if (result) {
+		lock_acquire(p->p_uthread_lock);
+		for (utp = &p->p_uthreads; *utp != ut;
+		     utp = &(*utp)->ut_next) {
+			KASSERT(*utp != NULL);
+		}
+		*utp = ut->ut_next;
+		p->p_nuthreads--;
+		lock_release(p->p_uthread_lock);
+		as_free_threadstack(curproc_getas(), ut->ut_stackslot);
+		kfree(ut);
+		return result;
+	}
+	return 0;
+}
+
+void
+sys_thread_exit(userptr_t retval)
+{
+	struct proc *p = curproc;
+	struct uthread *ut;
+
+	lock_acquire(p->p_uthread_lock);
+	for (ut = p->p_uthreads; ut != NULL; ut = ut->ut_next) {
+		if (!ut->ut_exited && ut->ut_thread == curthread) {
+			break;
+		}
+	}
+	if (ut != NULL) {
+		/*
+		 * Our struct thread may be reused for another thread of
+		 * this process, so don't leave the record pointing at it.
+		 */
+		ut->ut_thread = NULL;
+		ut->ut_exited = true;
+		ut->ut_retval = retval;
+		cv_broadcast(p->p_uthread_cv, p->p_uthread_lock);
+	}
+	else if (!p->p_exiting) {
+		/*
+		 * It's the first thread, which has no record. crt0 leaves
+		 * this way when main returns, so the other threads run on;
+		 * the value is the exit status if nobody calls _exit.
+		 */
+		p->p_exitcode = (int)retval;
+	}
+	lock_release(p->p_uthread_lock);
+
+	if (ut != NULL) {
+		/* we're done with it; the record stays for thread_join */
+		as_free_threadstack(curproc_getas(), ut->ut_stackslot);
+	}
+	uthread_leave();
+}
+
+int
+sys_thread_join(int tid, userptr_t retvalp)
+{
+	struct proc *p = curproc;
+	struct uthread *ut, **utp;
+	userptr_t retval;
+
+	lock_acquire(p->p_uthread_lock);
+	while (1) {
+		/* look again each time; another joiner may have taken it */
+		for (utp = &p->p_uthreads; *utp != NULL;
+		     utp = &(*utp)->ut_next) {
+			if ((*utp)->ut_tid == tid) {
+				break;
+			}
+		}
+		ut = *utp;
+		if (ut == NULL) {
+			lock_release(p->p_uthread_lock);
+			return ESRCH;
+		}
+		if (ut->ut_thread == curthread) {
+			lock_release(p->p_uthread_lock);
+			return EINVAL;
+		}
+		if (ut->ut_exited) {
+			break;
+		}
+		if (p->p_exiting) {
+			lock_release(p->p_uthread_lock);
+			return EINTR;
+		}
+		cv_wait(p->p_uthread_cv, p->p_uthread_lock);
+	}
+	*utp = ut->ut_next;
+	lock_release(p->p_uthread_lock);
+
+	retval = ut->ut_retval;
+	kfree(ut);
+	if (retvalp != NULL) {
+		return copyout(&retval, retvalp, sizeof(retval));
+	}
+	return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Atomic operations test and microbenchmark.
+ *
+ * First checks that each operation does what it says on one thread.
+ * Then has NTHREADS threads hammer one counter, once with atomic_add
+ * and once with a spinlock around a plain increment, checking that
+ * no increments were lost and printing how long each took.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <atomic.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define NTHREADS	8
+#define NLOOPS		20000
+
+static struct atomic atomic_counter;
+static struct spinlock spin_counter_lock = SPINLOCK_INITIALIZER;
+static volatile int spin_counter;
+static bool bench_useatomic;
+static struct semaphore *atomicdone;
+
+static
+int
+atomic_checkops(void)
+{
+	struct atomic a;
+	int bad = 0;
+
+	atomic_init(&a, 5);
+	if (atomic_add(&a, 3) != 8 || atomic_get(&a) != 8) {
+		kprintf("atomic_add: wrong result\n");
+		bad++;
+	}
+	if (atomic_add(&a, -8) != 0) {
+		kprintf("atomic_add: negative delta wrong\n");
+		bad++;
+	}
+	if (atomic_cas(&a, 1, 7) != 0 || atomic_get(&a) != 0) {
+		kprintf("atomic_cas: swapped on mismatch\n");
+		bad++;
+	}
+	if (atomic_cas(&a, 0, 7) != 0 || atomic_get(&a) != 7) {
+		kprintf("atomic_cas: didn't swap on match\n");
+		bad++;
+	}
+	if (atomic_swap(&a, 2) != 7 || atomic_get(&a) != 2) {
+		kprintf("atomic_swap: wrong result\n");
+		bad++;
+	}
+	if (atomic_fetch_or(&a, 5) != 2 || atomic_get(&a) != 7) {
+		kprintf("atomic_fetch_or: wrong result\n");
+		bad++;
+	}
+	membar_sync();
+	return bad;
+}
+
+static
+void
+atomicthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NLOOPS; i++) {
+		if (bench_useatomic) {
+			atomic_add(&atomic_counter, 1);
+		}
+		else {
+			spinlock_acquire(&spin_counter_lock);
+			spin_counter++;
+			spinlock_release(&spin_counter_lock);
+		}
+	}
+	V(atomicdone);
+}
+
+/* Run the threads; returns elapsed ms. */
+static
+unsigned long
+atomic_run(bool useatomic)
+{
+	int i, result;
+	time_t secs1, secs2, rsecs;
+	uint32_t nsecs1, nsecs2, rnsecs;
+
+	bench_useatomic = useatomic;
+	gettime(&secs1, &nsecs1);
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("atomictest", NULL, atomicthread, NULL, i);
+		if (result) {
+			panic("atomictest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(atomicdone);
+	}
+	gettime(&secs2, &nsecs2);
+	getinterval(secs1, nsecs1, secs2, nsecs2, &rsecs, &rnsecs);
+	return rsecs * 1000 + rnsecs / 1000000;
+}
+
+int
+atomictest(int nargs, char **args)
+{
+	unsigned long atomicms, spinms;
+	int bad;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting atomic ops test...\n");
+	bad = atomic_checkops();
+
+	atomicdone = sem_create("atomicdone", 0);
+	if (atomicdone == NULL) {
+		panic("atomictest: sem_create failed\n");
+	}
+	atomic_init(&atomic_counter, 0);
+	spin_counter = 0;
+
+	atomicms = atomic_run(true);
+	spinms = atomic_run(false);
+	sem_destroy(atomicdone);
+
+	if (atomic_get(&atomic_counter) != NTHREADS * NLOOPS) {
+		kprintf("atomic counter is %d, should be %d\n",
+			atomic_get(&atomic_counter), NTHREADS * NLOOPS);
+		bad++;
+	}
+	if (spin_counter != NTHREADS * NLOOPS) {
+		kprintf("spinlock counter is %d, should be %d\n",
+			spin_counter, NTHREADS * NLOOPS);
+		bad++;
+	}
+	kprintf("%d threads x %d increments: atomic_add %lu ms, "
+		"spinlock %lu ms\n", NTHREADS, NLOOPS, atomicms, spinms);
+
+	if (bad) {
+		kprintf("Atomic ops test failed\n");
+	}
+	else {
+		kprintf("Atomic ops test done.\n");
+	}
+	return 0;
+}
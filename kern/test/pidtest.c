@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pid table test and benchmark.
+ *
+ * Fills the table with PIDTEST_N records under pids above PID_MAX, so
+ * they can't clash with real processes, checks that each can be found
+ * and removed again, and times insert, lookup and remove per record.
+ * For comparison it also times the same lookups done the old way, by
+ * scanning an array of all the records.
+ *
+ * Then takes PIDTEST_N real pids from pid_alloc, checking they're all
+ * different, and gives them back, timing both; and checks that a pid
+ * just freed isn't handed straight out again.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <array.h>
+#include <bitmap.h>
+#include <clock.h>
+#include <limits.h>
+#include <proc.h>
+#include <synch.h>
+#include <test.h>
+
+#define PIDTEST_N	4000
+
+static
+unsigned long
+pidtest_ns(uint64_t start)
+{
+	return (unsigned long)((gettime_ns() - start) / PIDTEST_N);
+}
+
+static
+unsigned
+pidalloctest(void)
+{
+	pid_t *pids, pid, pid2;
+	struct bitmap *seen;
+	uint64_t start;
+	unsigned long allocns, freens;
+	unsigned i, bad = 0;
+
+	pids = kmalloc(PIDTEST_N * sizeof(*pids));
+	seen = bitmap_create(PID_MAX + 1);
+	if (pids == NULL || seen == NULL) {
+		panic("pidtest: out of memory\n");
+	}
+
+	start = gettime_ns();
+	for (i=0; i<PIDTEST_N; i++) {
+		if (pid_alloc(&pids[i])) {
+			panic("pidtest: out of pids\n");
+		}
+	}
+	allocns = pidtest_ns(start);
+
+	for (i=0; i<PIDTEST_N; i++) {
+		if (pids[i] < PID_MIN || pids[i] > PID_MAX ||
+		    bitmap_isset(seen, pids[i])) {
+			bad++;
+			continue;
+		}
+		bitmap_mark(seen, pids[i]);
+	}
+
+	start = gettime_ns();
+	for (i=0; i<PIDTEST_N; i++) {
+		pid_free(pids[i]);
+	}
+	freens = pidtest_ns(start);
+
+	if (pid_alloc(&pid)) {
+		panic("pidtest: out of pids\n");
+	}
+	pid_free(pid);
+	if (pid_alloc(&pid2)) {
+		panic("pidtest: out of pids\n");
+	}
+	if (pid2 == pid) {
+		kprintf("pid %d reused at once\n", pid);
+		bad++;
+	}
+	pid_free(pid2);
+
+	kprintf("pid_alloc %lu ns, pid_free %lu ns each\n", allocns, freens);
+
+	bitmap_destroy(seen);
+	kfree(pids);
+	return bad;
+}
+
+int
+pidtest(int nargs, char **args)
+{
+	struct process *recs, *p;
+	struct array *arr;
+	uint64_t start;
+	unsigned long addns, findns, scanns, remns;
+	unsigned i, j, k, bad = 0;
+
+	(void)nargs;
+	(void)args;
+
+	recs = kmalloc(PIDTEST_N * sizeof(*recs));
+	arr = array_create();
+	if (recs == NULL || arr == NULL) {
+		panic("pidtest: out of memory\n");
+	}
+	for (i=0; i<PIDTEST_N; i++) {
+		recs[i].pid = PID_MAX + 1 + i;
+		recs[i].exited = false;
+		recs[i].exitcode = 0;
+		recs[i].parent = NULL;
+		if (array_add(arr, &recs[i], NULL)) {
+			panic("pidtest: out of memory\n");
+		}
+	}
+
+	kprintf("Starting pid table test with %u processes...\n", PIDTEST_N);
+	lock_acquire(lk);
+
+	start = gettime_ns();
+	for (i=0; i<PIDTEST_N; i++) {
+		pidtable_add(&recs[i]);
+	}
+	addns = pidtest_ns(start);
+
+	start = gettime_ns();
+	for (i=0; i<PIDTEST_N; i++) {
+		/* look them up in a different order than added */
+		j = (i * 7919) % PIDTEST_N;
+		if (pidtable_lookup(recs[j].pid) != &recs[j]) {
+			bad++;
+		}
+	}
+	findns = pidtest_ns(start);
+
+	start = gettime_ns();
+	for (i=0; i<PIDTEST_N; i++) {
+		j = (i * 7919) % PIDTEST_N;
+		for (k=0; k<array_num(arr); k++) {
+			p = array_get(arr, k);
+			if (p->pid == recs[j].pid) {
+				break;
+			}
+		}
+	}
+	scanns = pidtest_ns(start);
+
+	start = gettime_ns();
+	for (i=0; i<PIDTEST_N; i++) {
+		pidtable_remove(&recs[i]);
+	}
+	remns = pidtest_ns(start);
+
+	for (i=0; i<PIDTEST_N; i++) {
+		if (pidtable_lookup(recs[i].pid) != NULL) {
+			bad++;
+		}
+	}
+	lock_release(lk);
+
+	kprintf("add %lu ns, lookup %lu ns, remove %lu ns each\n",
+		addns, findns, remns);
+	kprintf("lookup by scanning all %u: %lu ns each\n",
+		PIDTEST_N, scanns);
+
+	array_setsize(arr, 0);
+	array_destroy(arr);
+	kfree(recs);
+
+	bad += pidalloctest();
+	if (bad > 0) {
+		kprintf("Pid table test failed: %u errors\n", bad);
+	}
+	else {
+		kprintf("Pid table test done.\n");
+	}
+	return 0;
+}
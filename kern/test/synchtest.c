@@ -32,8 +32,11 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
+#include <current.h>
+#include <spinlock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -42,6 +45,15 @@
 #define NLOCKLOOPS    120
 #define NCVLOOPS      5
 #define NTHREADS      32
+#define NRWLOOPS      200
+#define RWWRITEPCT    10	/* percent of rwtest operations that write */
+#define RWHOLDLOOPS   200	/* busy loop inside the critical section */
+#define PIHOGS        4		/* CPU-bound threads in pitest */
+#define PIROUNDS      5
+#define PIHOLDLOOPS   200000	/* low thread's work with the lock held */
+#define PIDEMOTETICKS 64	/* give up waiting to sink after this */
+#define TWTICKS       5		/* timeout used by timedtest */
+#define TWTICKMS      10	/* ms per timer tick (LT_GRANULARITY) */
 
 static volatile unsigned long testval1;
 static volatile unsigned long testval2;
@@ -347,3 +359,513 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Reader-writer lock test.
+ *
+ * Each thread does NRWLOOPS operations on the rwlock, mostly reads,
+ * RWWRITEPCT percent writes, and now and then an upgrade from read to
+ * write and a downgrade back. Counters of who is inside are kept
+ * under a spinlock and checked: never a writer alongside anybody
+ * else, and the testvals, which writers change together, always
+ * consistent.
+ *
+ * Then the same read-mostly load is timed with a plain lock in place
+ * of the rwlock, for comparison.
+ */
+
+static struct rwlock *testrw;
+static struct lock *rwbenchlock;
+static bool rwtest_uselock;
+static struct spinlock rwtest_statlock = SPINLOCK_INITIALIZER;
+static unsigned rwtest_readers;		/* readers inside now */
+static unsigned rwtest_writers;		/* writers inside now */
+static unsigned rwtest_maxreaders;	/* most readers inside at once */
+static unsigned rwtest_failures;
+
+static
+void
+rwtest_fail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	spinlock_acquire(&rwtest_statlock);
+	rwtest_failures++;
+	spinlock_release(&rwtest_statlock);
+}
+
+static
+void
+rwtest_enter(unsigned long num, bool writer)
+{
+	bool bad;
+
+	spinlock_acquire(&rwtest_statlock);
+	if (writer) {
+		bad = rwtest_readers > 0 || rwtest_writers > 0;
+		rwtest_writers++;
+	}
+	else {
+		bad = rwtest_writers > 0;
+		rwtest_readers++;
+		if (rwtest_readers > rwtest_maxreaders) {
+			rwtest_maxreaders = rwtest_readers;
+		}
+	}
+	spinlock_release(&rwtest_statlock);
+	if (bad) {
+		rwtest_fail(num, writer ? "writer not alone" :
+			    "reader alongside writer");
+	}
+}
+
+static
+void
+rwtest_leave(bool writer)
+{
+	spinlock_acquire(&rwtest_statlock);
+	if (writer) {
+		rwtest_writers--;
+	}
+	else {
+		rwtest_readers--;
+	}
+	spinlock_release(&rwtest_statlock);
+}
+
+static
+void
+rwtest_check(unsigned long num)
+{
+	volatile int j;
+
+	for (j=0; j<RWHOLDLOOPS; j++);
+	if (testval2 != testval1*testval1 || testval3 != testval1%3) {
+		rwtest_fail(num, "inconsistent testvals");
+	}
+}
+
+static
+void
+rwtest_write(unsigned long num)
+{
+	testval1 = num;
+	testval2 = num*num;
+	testval3 = num%3;
+	rwtest_check(num);
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i;
+	uint32_t r;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		r = random() % 100;
+		if (rwtest_uselock) {
+			/* benchmark only; no checking */
+			lock_acquire(rwbenchlock);
+			if (r < RWWRITEPCT) {
+				rwtest_write(num);
+			}
+			else {
+				rwtest_check(num);
+			}
+			lock_release(rwbenchlock);
+		}
+		else if (r < RWWRITEPCT / 2) {
+			rwlock_acquire_write(testrw);
+			rwtest_enter(num, true);
+			rwtest_write(num);
+			rwtest_leave(true);
+			rwlock_release_write(testrw);
+		}
+		else if (r < RWWRITEPCT) {
+			rwlock_acquire_read(testrw);
+			rwtest_enter(num, false);
+			rwtest_check(num);
+			rwtest_leave(false);
+			rwlock_upgrade(testrw);
+			rwtest_enter(num, true);
+			rwtest_write(num);
+			rwtest_leave(true);
+			rwlock_downgrade(testrw);
+			rwtest_enter(num, false);
+			if (testval1 != num) {
+				rwtest_fail(num, "write lost across downgrade");
+			}
+			rwtest_leave(false);
+			rwlock_release_read(testrw);
+		}
+		else {
+			rwlock_acquire_read(testrw);
+			rwtest_enter(num, false);
+			rwtest_check(num);
+			rwtest_leave(false);
+			rwlock_release_read(testrw);
+		}
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+/* Run NTHREADS of rwtestthread and return the elapsed time in ms. */
+static
+unsigned long
+rwtest_run(void)
+{
+	int i, result;
+	time_t secs1, secs2, rsecs;
+	uint32_t nsecs1, nsecs2, rnsecs;
+
+	gettime(&secs1, &nsecs1);
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, rwtestthread, NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+	gettime(&secs2, &nsecs2);
+	getinterval(secs1, nsecs1, secs2, nsecs2, &rsecs, &rnsecs);
+	return rsecs * 1000 + rnsecs / 1000000;
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	unsigned long rwms, lockms;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	rwbenchlock = lock_create("rwbenchlock");
+	if (rwbenchlock == NULL) {
+		panic("rwtest: lock_create failed\n");
+	}
+	testval1 = 0;
+	testval2 = 0;
+	testval3 = 0;
+	rwtest_readers = rwtest_writers = 0;
+	rwtest_maxreaders = 0;
+	rwtest_failures = 0;
+
+	kprintf("Starting rwlock test...\n");
+	rwtest_uselock = false;
+	rwms = rwtest_run();
+	kprintf("rwlock: %lu ms, up to %u readers at once\n",
+		rwms, rwtest_maxreaders);
+
+	rwtest_uselock = true;
+	lockms = rwtest_run();
+	kprintf("lock:   %lu ms\n", lockms);
+
+	rwlock_destroy(testrw);
+	lock_destroy(rwbenchlock);
+#ifdef UW
+  cleanitems();
+#endif
+	if (rwtest_failures > 0) {
+		kprintf("rwlock test failed: %u errors\n", rwtest_failures);
+	}
+	else {
+		kprintf("rwlock test done.\n");
+	}
+	return 0;
+}
+
+/*
+ * Priority inversion test.
+ *
+ * A CPU-bound "low" thread sinks to the bottom MLFQ level, takes a
+ * lock, and works with it held while PIHOGS other CPU-bound threads
+ * compete with it. The test thread, which stays at the top by
+ * napping, then waits for the lock. Without priority inheritance the
+ * low thread only gets its share of the cpu alongside the hogs; with
+ * it, it runs ahead of them until it lets go. The worst wait over
+ * PIROUNDS rounds is reported both ways. Best run with "sched mlfq"
+ * and a single cpu, where the hogs can't go elsewhere.
+ */
+static struct lock *pilock;
+static volatile bool pitest_stop;
+static volatile bool pitest_held;
+
+static
+void
+pitest_spin(unsigned long loops)
+{
+	volatile unsigned long x = 0;
+	unsigned long i;
+
+	for (i=0; i<loops; i++) {
+		x += i;
+	}
+}
+
+static
+void
+pitest_hog(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	while (!pitest_stop) {
+		pitest_spin(1000);
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+static
+void
+pitest_low(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	while (curthread->t_priority < SCHED_NPRIO - 1 &&
+	       curthread->t_cputicks < PIDEMOTETICKS) {
+		pitest_spin(1000);
+	}
+	lock_acquire(pilock);
+	pitest_held = true;
+	pitest_spin(PIHOLDLOOPS);
+	lock_release(pilock);
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+/* One round; returns how long the test thread waited, in us. */
+static
+unsigned long
+pitest_round(void)
+{
+	int i, result;
+	uint64_t start, waited;
+
+	pitest_stop = false;
+	pitest_held = false;
+	for (i=0; i<PIHOGS; i++) {
+		result = thread_fork("pihog", NULL, pitest_hog, NULL, i);
+		if (result) {
+			panic("pitest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	result = thread_fork("pilow", NULL, pitest_low, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+
+	while (!pitest_held) {
+		clocknap(1);
+	}
+	start = gettime_ns();
+	lock_acquire(pilock);
+	waited = gettime_ns() - start;
+	lock_release(pilock);
+
+	pitest_stop = true;
+	for (i=0; i<PIHOGS+1; i++) {
+		P(donesem);
+	}
+	return (unsigned long)(waited / 1000);
+}
+
+static
+unsigned long
+pitest_run(void)
+{
+	unsigned long us, worst = 0;
+	int i;
+
+	for (i=0; i<PIROUNDS; i++) {
+		us = pitest_round();
+		if (us > worst) {
+			worst = us;
+		}
+	}
+	return worst;
+}
+
+int
+pitest(int nargs, char **args)
+{
+	unsigned long inherit, noinherit;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	pilock = lock_create("pilock");
+	if (pilock == NULL) {
+		panic("pitest: lock_create failed\n");
+	}
+
+	kprintf("Starting priority inversion test...\n");
+	lock_setinherit(false);
+	noinherit = pitest_run();
+	kprintf("without inheritance: worst wait %lu us\n", noinherit);
+
+	lock_setinherit(true);
+	inherit = pitest_run();
+	kprintf("with inheritance:    worst wait %lu us\n", inherit);
+
+	lock_destroy(pilock);
+#ifdef UW
+  cleanitems();
+#endif
+	kprintf("Priority inversion test done.\n");
+	return 0;
+}
+
+/*
+ * Timed wait test: P_timed and cv_timedwait must time out when
+ * nothing happens, taking about as long as asked, and must return
+ * success without waiting out the timeout when woken in time.
+ */
+static struct semaphore *twsem;
+static struct lock *twlock;
+static struct cv *twcv;
+static volatile bool twflag;
+static unsigned twfailures;
+
+static
+void
+timedtest_waker(void *junk, unsigned long num)
+{
+	(void)junk;
+
+	clocknap(1);
+	if (num == 0) {
+		V(twsem);
+	}
+	else {
+		lock_acquire(twlock);
+		twflag = true;
+		cv_signal(twcv, twlock);
+		lock_release(twlock);
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+static
+void
+timedtest_check(const char *what, int result, int expected,
+		uint64_t start, bool waitedout)
+{
+	unsigned long ms;
+
+	ms = (unsigned long)((gettime_ns() - start) / 1000000);
+	kprintf("%s: %s after %lu ms\n", what,
+		result == 0 ? "woken" : "timed out", ms);
+	if (result != expected) {
+		kprintf("%s: expected %s\n", what,
+			expected == 0 ? "wakeup" : "timeout");
+		twfailures++;
+	}
+	else if (waitedout && ms < (TWTICKS - 1) * TWTICKMS) {
+		kprintf("%s: timed out early\n", what);
+		twfailures++;
+	}
+	else if (!waitedout && ms >= TWTICKS * 10 * TWTICKMS) {
+		kprintf("%s: waited out the timeout anyway\n", what);
+		twfailures++;
+	}
+}
+
+static
+void
+timedtest_fork(unsigned long num)
+{
+	int result;
+
+	result = thread_fork("timedtest", NULL, timedtest_waker, NULL, num);
+	if (result) {
+		panic("timedtest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+}
+
+int
+timedtest(int nargs, char **args)
+{
+	uint64_t start;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	twsem = sem_create("twsem", 0);
+	twlock = lock_create("twlock");
+	twcv = cv_create("twcv");
+	if (twsem == NULL || twlock == NULL || twcv == NULL) {
+		panic("timedtest: out of memory\n");
+	}
+	twfailures = 0;
+
+	kprintf("Starting timed wait test...\n");
+
+	start = gettime_ns();
+	result = P_timed(twsem, TWTICKS);
+	timedtest_check("P_timed, no V", result, ETIMEDOUT, start, true);
+
+	timedtest_fork(0);
+	start = gettime_ns();
+	result = P_timed(twsem, TWTICKS * 10);
+	timedtest_check("P_timed, V", result, 0, start, false);
+	P(donesem);
+
+	lock_acquire(twlock);
+	start = gettime_ns();
+	result = cv_timedwait(twcv, twlock, TWTICKS);
+	KASSERT(lock_do_i_hold(twlock));
+	timedtest_check("cv_timedwait, no signal", result, ETIMEDOUT,
+			start, true);
+
+	twflag = false;
+	timedtest_fork(1);
+	start = gettime_ns();
+	result = 0;
+	while (!twflag && result == 0) {
+		result = cv_timedwait(twcv, twlock, TWTICKS * 10);
+	}
+	timedtest_check("cv_timedwait, signal", result, 0, start, false);
+	lock_release(twlock);
+	P(donesem);
+
+	sem_destroy(twsem);
+	lock_destroy(twlock);
+	cv_destroy(twcv);
+#ifdef UW
+  cleanitems();
+#endif
+	if (twfailures > 0) {
+		kprintf("Timed wait test failed: %u errors\n", twfailures);
+	}
+	else {
+		kprintf("Timed wait test done.\n");
+	}
+	return 0;
+}
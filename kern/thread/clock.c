@@ -30,6 +30,7 @@
 #include <types.h>
 #include <lib.h>
 #include <cpu.h>
+#include <spinlock.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
@@ -52,26 +53,39 @@
  * the scheduler.
  */
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * number of timer ticks per second
  */
-static struct wchan *lbolt;
+#define TICKS_PER_SECOND (1000000/LT_GRANULARITY)
+
 /*
- * Once every LT_GRANULARITY usec, everything on minibolt is awakenened by CPU 0
+ * Callout wheel.
+ *
+ * Pending callouts are hashed by expiry tick into CALLOUT_WHEELSIZE
+ * buckets. Each timer tick looks at exactly one bucket and runs the
+ * callouts in it that expire on that tick; callouts more than one
+ * trip around the wheel away just stay put. So the per-tick cost is
+ * proportional to what actually expires (plus the occasional
+ * long-term entry sharing its bucket), not to the number pending.
+ *
+ * callout_ticks counts timer ticks since boot. Everything here is
+ * protected by callout_lock.
  */
-static struct wchan *minibolt;
+#define CALLOUT_WHEELSIZE	256	/* must be a power of 2 */
+#define CALLOUT_WHEELMASK	(CALLOUT_WHEELSIZE - 1)
 
-/* 
- * number of minibolts per second
- */
-#define MINI_PER_SECOND (1000000/LT_GRANULARITY);
+static struct callout *callout_wheel[CALLOUT_WHEELSIZE];
+static unsigned callout_ticks;
+static struct spinlock callout_lock;
 
 /*
- * minibolt countdown
+ * Sleepers in clocknap wait on one of these, chosen by hashing the
+ * thread pointer, so a wakeup only disturbs the (usually zero) other
+ * sleepers that happen to share the slot.
  */
-static int minicount;
+#define CLOCK_NSLEEPCHANS	32
+static struct wchan *clock_sleepchans[CLOCK_NSLEEPCHANS];
 
 /*
  * Setup.
@@ -79,32 +93,133 @@ static int minicount;
 void
 hardclock_bootstrap(void)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	unsigned i;
+
+	spinlock_init(&callout_lock);
+	callout_ticks = 0;
+	for (i=0; i<CALLOUT_WHEELSIZE; i++) {
+		callout_wheel[i] = NULL;
+	}
+	for (i=0; i<CLOCK_NSLEEPCHANS; i++) {
+		clock_sleepchans[i] = wchan_create("clocknap");
+		if (clock_sleepchans[i] == NULL) {
+			panic("Couldn't create clocknap wait channels\n");
+		}
+	}
+	/* we assume TICKS_PER_SECOND > 0 */
+	KASSERT(TICKS_PER_SECOND > 0);
+}
+
+/*
+ * Prepare a callout to call FUNC(ARG) when it expires.
+ */
+void
+callout_init(struct callout *co, void (*func)(void *), void *arg)
+{
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+	co->co_expire = 0;
+	co->co_func = func;
+	co->co_arg = arg;
+}
+
+/* Unlink a pending callout. callout_lock must be held. */
+static
+void
+callout_unlink(struct callout *co)
+{
+	KASSERT(spinlock_do_i_hold(&callout_lock));
+	KASSERT(co->co_prevp != NULL);
+
+	*co->co_prevp = co->co_next;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = co->co_prevp;
+	}
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+}
+
+/*
+ * Arrange for a callout to run TICKS timer ticks from now (at least
+ * one). If it was already pending it is rescheduled.
+ */
+void
+callout_schedule(struct callout *co, unsigned ticks)
+{
+	struct callout **bucket;
+
+	if (ticks == 0) {
+		ticks = 1;
+	}
+
+	spinlock_acquire(&callout_lock);
+	if (co->co_prevp != NULL) {
+		callout_unlink(co);
+	}
+	co->co_expire = callout_ticks + ticks;
+	bucket = &callout_wheel[co->co_expire & CALLOUT_WHEELMASK];
+	co->co_next = *bucket;
+	co->co_prevp = bucket;
+	if (*bucket != NULL) {
+		(*bucket)->co_prevp = &co->co_next;
 	}
-	minibolt = wchan_create("minibolt");
-	if (minibolt == NULL) {
-		panic("Couldn't create minibolt\n");
+	*bucket = co;
+	spinlock_release(&callout_lock);
+}
+
+/*
+ * Cancel a pending callout. Returns true if it was pending, false if
+ * it had already expired (in which case its function may still be
+ * running on the cpu that takes timer interrupts).
+ */
+bool
+callout_stop(struct callout *co)
+{
+	bool pending;
+
+	spinlock_acquire(&callout_lock);
+	pending = co->co_prevp != NULL;
+	if (pending) {
+		callout_unlink(co);
 	}
-	minicount = MINI_PER_SECOND;
-	/* we assume MINI_PER_SECOND > 0 */
-	KASSERT(minicount > 0);
+	spinlock_release(&callout_lock);
+	return pending;
 }
 
 /*
  * This is called once every every LT_GRANULARITY usec, on one processor,
  * by the timer code.
+ *
+ * Expired callouts are collected under the lock and then run without
+ * it, so they may reschedule themselves or wake threads up. Each one
+ * is unlinked before its function is called and not touched after,
+ * so the function may free or reuse it.
  */
 void
 timerclock(void)
 {
-	/* Broadcast on minibolt */
-	wchan_wakeall(minibolt);
-	/* Broadcast on lbolt if a second has elapsed */
-	if (--minicount <= 0) {
-	  minicount = MINI_PER_SECOND;
-	  wchan_wakeall(lbolt);
+	struct callout *co, *next, *expired;
+
+	expired = NULL;
+	spinlock_acquire(&callout_lock);
+	callout_ticks++;
+	co = callout_wheel[callout_ticks & CALLOUT_WHEELMASK];
+	while (co != NULL) {
+		next = co->co_next;
+		if (co->co_expire == callout_ticks) {
+			callout_unlink(co);
+			co->co_next = expired;
+			expired = co;
+		}
+		co = next;
+	}
+	spinlock_release(&callout_lock);
+
+	while (expired != NULL) {
+		co = expired;
+		expired = co->co_next;
+		co->co_next = NULL;
+		co->co_func(co->co_arg);
 	}
 }
 
@@ -115,18 +230,46 @@ timerclock(void)
 void
 hardclock(void)
 {
+	bool preempt;
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
 	curcpu->c_hardclocks++;
+	preempt = thread_tick();
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
+	if (preempt) {
+		thread_yield();
 	}
-	thread_yield();
+}
+
+/*
+ * State for one thread in clocknap. Lives on the sleeper's stack.
+ */
+struct clocksleeper {
+	struct wchan *cs_wchan;
+	bool cs_done;		/* protected by cs_wchan's lock */
+};
+
+/*
+ * Callout function for clocknap. Once cs_done is set and the channel
+ * unlocked the sleeper may return and its stack go away, so the
+ * sleeper record must not be touched after that.
+ */
+static
+void
+clocknap_wakeup(void *arg)
+{
+	struct clocksleeper *cs = arg;
+	struct wchan *wc = cs->cs_wchan;
+
+	wchan_lock(wc);
+	cs->cs_done = true;
+	wchan_unlock(wc);
+	wchan_wakeall(wc);
 }
 
 /*
@@ -135,10 +278,8 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-  while (num_secs > 0) {
-    wchan_lock(lbolt);
-    wchan_sleep(lbolt);
-    num_secs--;
+  if (num_secs > 0) {
+    clocknap(num_secs * TICKS_PER_SECOND);
   }
 }
 
@@ -149,9 +290,23 @@ clocksleep(int num_secs)
 void
 clocknap(int num_ticks)
 {
-  while (num_ticks > 0) {
-    wchan_lock(minibolt);
-    wchan_sleep(minibolt);
-    num_ticks--;
+  struct clocksleeper cs;
+  struct callout co;
+
+  if (num_ticks <= 0) {
+    return;
+  }
+
+  cs.cs_wchan = clock_sleepchans[((uintptr_t)curthread >> 4) %
+				 CLOCK_NSLEEPCHANS];
+  cs.cs_done = false;
+  callout_init(&co, clocknap_wakeup, &cs);
+
+  wchan_lock(cs.cs_wchan);
+  callout_schedule(&co, num_ticks);
+  while (!cs.cs_done) {
+    wchan_sleep(cs.cs_wchan);
+    wchan_lock(cs.cs_wchan);
   }
+  wchan_unlock(cs.cs_wchan);
 }
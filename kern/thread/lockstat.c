@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention profiler. See lockstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <lockstat.h>
+
+#if OPT_LOCKSTAT
+/* Every lock acquired at least once. */
+static struct lockstat *lockstat_list;
+static struct spinlock lockstat_lock = SPINLOCK_INITIALIZER;
+#endif
+
+void
+lockstat_init(struct lockstat *ls)
+{
+	ls->ls_name = NULL;
+	ls->ls_next = NULL;
+	ls->ls_listed = false;
+	ls->ls_acquires = 0;
+	ls->ls_contended = 0;
+	ls->ls_waittotal = 0;
+	ls->ls_waitmax = 0;
+	ls->ls_holdtotal = 0;
+	ls->ls_holdmax = 0;
+	ls->ls_holdstart = 0;
+}
+
+uint64_t
+lockstat_now(void)
+{
+	return gettime_ns();
+}
+
+void
+lockstat_acquired(struct lockstat *ls, const char *name,
+		  uint64_t waitstart, bool contended)
+{
+	uint64_t now, wait;
+
+#if OPT_LOCKSTAT
+	if (!ls->ls_listed) {
+		ls->ls_name = name;
+		spinlock_acquire(&lockstat_lock);
+		ls->ls_next = lockstat_list;
+		lockstat_list = ls;
+		ls->ls_listed = true;
+		spinlock_release(&lockstat_lock);
+	}
+#else
+	ls->ls_name = name;
+#endif
+
+	now = gettime_ns();
+	ls->ls_acquires++;
+	if (contended) {
+		ls->ls_contended++;
+		if (waitstart != 0) {
+			wait = now - waitstart;
+			ls->ls_waittotal += wait;
+			if (wait > ls->ls_waitmax) {
+				ls->ls_waitmax = wait;
+			}
+		}
+	}
+	ls->ls_holdstart = now;
+}
+
+void
+lockstat_releasing(struct lockstat *ls)
+{
+	uint64_t hold;
+
+	if (ls->ls_holdstart == 0) {
+		/* acquired before the clock was attached */
+		return;
+	}
+	hold = gettime_ns() - ls->ls_holdstart;
+	ls->ls_holdtotal += hold;
+	if (hold > ls->ls_holdmax) {
+		ls->ls_holdmax = hold;
+	}
+	ls->ls_holdstart = 0;
+}
+
+void
+lockstat_cleanup(struct lockstat *ls)
+{
+#if OPT_LOCKSTAT
+	struct lockstat **lp;
+
+	if (!ls->ls_listed) {
+		return;
+	}
+	spinlock_acquire(&lockstat_lock);
+	for (lp = &lockstat_list; *lp != ls; lp = &(*lp)->ls_next) {
+		KASSERT(*lp != NULL);
+	}
+	*lp = ls->ls_next;
+	ls->ls_listed = false;
+	spinlock_release(&lockstat_lock);
+#else
+	(void)ls;
+#endif
+}
+
+#if OPT_LOCKSTAT
+
+/*
+ * Zero the counters. Locks stay on the list. A hold in progress keeps
+ * its start time so it is still counted when it ends.
+ */
+void
+lockstat_reset(void)
+{
+	struct lockstat *ls;
+
+	spinlock_acquire(&lockstat_lock);
+	for (ls = lockstat_list; ls != NULL; ls = ls->ls_next) {
+		ls->ls_acquires = 0;
+		ls->ls_contended = 0;
+		ls->ls_waittotal = 0;
+		ls->ls_waitmax = 0;
+		ls->ls_holdtotal = 0;
+		ls->ls_holdmax = 0;
+	}
+	spinlock_release(&lockstat_lock);
+}
+
+/*
+ * True if A sorts before B: more total wait first, ties broken by
+ * address so that every lock has a distinct place.
+ */
+static
+bool
+lockstat_before(struct lockstat *a, struct lockstat *b)
+{
+	if (a->ls_waittotal != b->ls_waittotal) {
+		return a->ls_waittotal > b->ls_waittotal;
+	}
+	return (uintptr_t)a > (uintptr_t)b;
+}
+
+/*
+ * Print the TOPN locks by total wait time. Selection by repeated
+ * passes, each finding the best lock after the previous one; TOPN is
+ * small and this needs no memory, which matters because kmalloc's own
+ * lock is on the list. Counters are read without the locks.
+ */
+void
+lockstat_print(unsigned topn)
+{
+	struct lockstat *ls, *best, *prev;
+	unsigned i;
+
+	kprintf("%-20s %9s %9s %10s %10s %10s %10s\n", "lock", "acquires",
+		"contended", "wait_us", "maxwait_us", "hold_us",
+		"maxhold_us");
+	spinlock_acquire(&lockstat_lock);
+	prev = NULL;
+	for (i=0; i<topn; i++) {
+		best = NULL;
+		for (ls = lockstat_list; ls != NULL; ls = ls->ls_next) {
+			if (prev != NULL && !lockstat_before(prev, ls)) {
+				continue;
+			}
+			if (best == NULL || lockstat_before(ls, best)) {
+				best = ls;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		kprintf("%-20s %9u %9u %10lu %10lu %10lu %10lu\n",
+			best->ls_name, best->ls_acquires, best->ls_contended,
+			(unsigned long)(best->ls_waittotal / 1000),
+			(unsigned long)(best->ls_waitmax / 1000),
+			(unsigned long)(best->ls_holdtotal / 1000),
+			(unsigned long)(best->ls_holdmax / 1000));
+		prev = best;
+	}
+	spinlock_release(&lockstat_lock);
+}
+
+#else /* !OPT_LOCKSTAT */
+
+void
+lockstat_reset(void)
+{
+	kprintf("lockstat not compiled in (options lockstat)\n");
+}
+
+void
+lockstat_print(unsigned topn)
+{
+	(void)topn;
+	kprintf("lockstat not compiled in (options lockstat)\n");
+}
+
+#endif /* OPT_LOCKSTAT */
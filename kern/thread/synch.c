@@ -33,11 +33,14 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <clock.h>
+#include <cpu.h>
 #include <synch.h>
 
 ////////////////////////////////////////////////////////////
@@ -143,14 +146,146 @@ V(struct semaphore *sem)
 	spinlock_release(&sem->sem_lock);
 }
 
+////////////////////////////////////////////////////////////
+//
+// Timed waits.
+
+/*
+ * State for one timed wait, on the waiter's stack. The callout sets
+ * tw_expired with the channel locked, so a waiter that checks it
+ * with the channel locked before sleeping can't miss the wakeup.
+ * Since the channel may have several sleepers, the wakeup is a
+ * wakeall; the others see nothing has changed and go back to sleep.
+ */
+struct timedwait {
+	struct wchan *tw_wchan;
+	struct callout tw_callout;
+	volatile bool tw_expired;	/* deadline passed */
+	volatile bool tw_done;		/* callout is finished with us */
+};
+
+static
+void
+timedwait_expire(void *arg)
+{
+	struct timedwait *tw = arg;
+	struct wchan *wc = tw->tw_wchan;
+
+	wchan_lock(wc);
+	tw->tw_expired = true;
+	wchan_unlock(wc);
+	wchan_wakeall(wc);
+	tw->tw_done = true;
+	/* the waiter may now return; don't touch tw again */
+}
+
+static
+void
+timedwait_start(struct timedwait *tw, struct wchan *wc, unsigned ticks)
+{
+	tw->tw_wchan = wc;
+	tw->tw_expired = false;
+	tw->tw_done = false;
+	callout_init(&tw->tw_callout, timedwait_expire, tw);
+	callout_schedule(&tw->tw_callout, ticks);
+}
+
+/*
+ * Disarm the deadline. If the callout already fired it may still be
+ * running on the cpu that takes timer interrupts, and it has our
+ * stack, so wait for it; it doesn't block, so that's brief.
+ */
+static
+void
+timedwait_finish(struct timedwait *tw)
+{
+	if (!callout_stop(&tw->tw_callout)) {
+		while (!tw->tw_done) {
+			/* spin */
+		}
+	}
+}
+
+int
+P_timed(struct semaphore *sem, unsigned ticks)
+{
+	struct timedwait tw;
+	int result = 0;
+
+        KASSERT(sem != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&sem->sem_lock);
+	if (sem->sem_count > 0) {
+		sem->sem_count--;
+		spinlock_release(&sem->sem_lock);
+		return 0;
+	}
+
+	timedwait_start(&tw, sem->sem_wchan, ticks);
+        while (sem->sem_count == 0) {
+		wchan_lock(sem->sem_wchan);
+		if (tw.tw_expired) {
+			wchan_unlock(sem->sem_wchan);
+			result = ETIMEDOUT;
+			break;
+		}
+		spinlock_release(&sem->sem_lock);
+                wchan_sleep(sem->sem_wchan);
+
+		spinlock_acquire(&sem->sem_lock);
+        }
+	if (result == 0) {
+		KASSERT(sem->sem_count > 0);
+		sem->sem_count--;
+	}
+	spinlock_release(&sem->sem_lock);
+
+	timedwait_finish(&tw);
+	return result;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Lock.
 
+/*
+ * Adaptive locks: how many times a waiter polls the holder, while the
+ * holder is running on another cpu, before giving up and sleeping.
+ */
+#define LOCK_SPIN_MAX 1000
+
+/* All adaptive locks, for lock_printstats. */
+static struct lock *adaptive_locks;
+static struct spinlock adaptive_locks_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Priority inheritance.
+ *
+ * A thread about to sleep on a held lock lends its priority to the
+ * holder, and if the holder is itself asleep on another lock, to that
+ * lock's holder, and so on down the chain. Each lock counts its
+ * sleepers by priority, so a holder letting go of one lock can work
+ * out what it is still owed through the others it holds.
+ *
+ * pi_lock protects lk_waiters and the threads' t_lentpriority,
+ * t_waitlock and t_waitprio. lk_nwaiters only changes with both
+ * pi_lock and the lock's spinlock held, so either will do to read
+ * it; and while it's nonzero, holder also only changes under pi_lock,
+ * so the chain can be followed holding pi_lock alone. Lock order is
+ * a lock's spinlock, then pi_lock, then run queue locks.
+ */
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+static bool pi_enabled = true;
+
+/* Longer chains than this are most likely a deadlock anyway. */
+#define PI_MAXDEPTH 16
+
 struct lock *
 lock_create(const char *name)
 {
         struct lock *lock;
+        int i;
 
         lock = kmalloc(sizeof(struct lock));
         if (lock == NULL) {
@@ -172,15 +307,59 @@ lock_create(const char *name)
           return NULL;
         }
         lock->holder = NULL;
+
+        lock->lk_adaptive = false;
+        lock->lk_next = NULL;
+        lock->lk_heldnext = NULL;
+        lock->lk_nwaiters = 0;
+        for (i=0; i<SCHED_NPRIO; i++) {
+                lock->lk_waiters[i] = 0;
+        }
+        lockstat_init(&lock->lk_lockstat);
+        lock->lk_spins = 0;
+        lock->lk_blocks = 0;
         
         return lock;
 }
 
+struct lock *
+lock_create_adaptive(const char *name)
+{
+        struct lock *lock;
+
+        lock = lock_create(name);
+        if (lock == NULL) {
+                return NULL;
+        }
+        lock->lk_adaptive = true;
+
+        spinlock_acquire(&adaptive_locks_lock);
+        lock->lk_next = adaptive_locks;
+        adaptive_locks = lock;
+        spinlock_release(&adaptive_locks_lock);
+
+        return lock;
+}
+
 void
 lock_destroy(struct lock *lock)
 {
+        struct lock **lp;
+
         KASSERT(lock != NULL);
         KASSERT(lock->wchan != NULL);
+        KASSERT(lock->lk_nwaiters == 0);
+
+        if (lock->lk_adaptive) {
+                spinlock_acquire(&adaptive_locks_lock);
+                for (lp = &adaptive_locks; *lp != lock; lp = &(*lp)->lk_next) {
+                        KASSERT(*lp != NULL);
+                }
+                *lp = lock->lk_next;
+                spinlock_release(&adaptive_locks_lock);
+        }
+
+        lockstat_cleanup(&lock->lk_lockstat);
 
         // add stuff here as needed
         spinlock_cleanup(&lock->spinlock);
@@ -190,34 +369,280 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+/*
+ * True if HOLDER is running right now on some other cpu, and so will
+ * likely release the lock soon without us having to sleep. The
+ * caller must hold the lock's spinlock, so HOLDER can't release the
+ * lock and go away while we look at it.
+ */
+static
+bool
+lock_holder_oncpu(struct thread *holder)
+{
+        return holder->t_state == S_RUN && holder->t_cpu != curcpu->c_self;
+}
+
+/*
+ * True if LOCK's acquires and holds are counted (in lk_lockstat): all
+ * locks under the lockstat option, and adaptive locks for
+ * lock_printstats.
+ */
+static
+bool
+lock_timed(struct lock *lock)
+{
+        return OPT_LOCKSTAT || lock->lk_adaptive;
+}
+
+/*
+ * Best priority among the threads asleep on LOCK, or SCHED_NOPRIO.
+ * pi_lock must be held.
+ */
+static
+int
+lock_bestwaiter(struct lock *lock)
+{
+        int prio;
+
+        for (prio=0; prio<SCHED_NPRIO; prio++) {
+                if (lock->lk_waiters[prio] > 0) {
+                        return prio;
+                }
+        }
+        return SCHED_NOPRIO;
+}
+
+/*
+ * Register the current thread as about to sleep on LOCK, and lend its
+ * priority down the chain of holders. It's counted at the priority it
+ * will have once asleep, since going to sleep can raise it (see
+ * thread_sleeppriority); if it's registered already, from an earlier
+ * sleep, it is recounted if that has gone up.
+ *
+ * When a holder along the way is itself waiting, it is recounted at
+ * its new priority on the lock it waits for, so that lock's holder
+ * can later tell what it owes. A holder already at least as good
+ * stops the walk: it was counted at that priority, so everything past
+ * it has been lent as much. Both LOCK's spinlock and pi_lock must be
+ * held.
+ */
+static
+void
+lock_addwaiter(struct lock *lock)
+{
+        struct thread *holder;
+        int prio;
+        unsigned depth;
+
+        prio = thread_sleeppriority(curthread);
+        if (curthread->t_waitlock == NULL) {
+                lock->lk_nwaiters++;
+                curthread->t_waitlock = lock;
+        }
+        else {
+                KASSERT(curthread->t_waitlock == lock);
+                if (prio >= curthread->t_waitprio) {
+                        return;
+                }
+                lock->lk_waiters[curthread->t_waitprio]--;
+        }
+        lock->lk_waiters[prio]++;
+        curthread->t_waitprio = prio;
+
+        for (depth=0; depth<PI_MAXDEPTH; depth++) {
+                holder = lock->holder;
+                if (holder == NULL || thread_priority(holder) <= prio) {
+                        return;
+                }
+                /* now thread_priority(holder) == prio */
+                thread_lendpriority(holder, prio);
+                lock = holder->t_waitlock;
+                if (lock == NULL) {
+                        return;
+                }
+                KASSERT(lock->lk_waiters[holder->t_waitprio] > 0);
+                lock->lk_waiters[holder->t_waitprio]--;
+                lock->lk_waiters[prio]++;
+                holder->t_waitprio = prio;
+        }
+}
+
+/*
+ * Take a priority back: recompute what the current thread is owed by
+ * the waiters on the locks it still holds. pi_lock must be held.
+ */
+static
+void
+lock_unlend(void)
+{
+        struct lock *held;
+        int prio, best;
+
+        best = SCHED_NOPRIO;
+        for (held = curthread->t_heldlocks; held != NULL;
+             held = held->lk_heldnext) {
+                prio = lock_bestwaiter(held);
+                if (prio < best) {
+                        best = prio;
+                }
+        }
+        if (best != curthread->t_lentpriority) {
+                thread_lendpriority(curthread, best);
+        }
+}
+
+void
+lock_setinherit(bool on)
+{
+        pi_enabled = on;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+        struct thread *holder;
+        unsigned i;
+        int prio;
+        bool spun = false, blocked = false;
+        uint64_t waitstart = 0;
+
         // Write this
         KASSERT(!lock_do_i_hold(lock));
         spinlock_acquire(&lock->spinlock);
         while(lock->holder != NULL) {
+          holder = lock->holder;
+#if OPT_LOCKSTAT
+          if (waitstart == 0) {
+            waitstart = lockstat_now();
+          }
+#endif
+          if (lock->lk_adaptive && !spun && lock_holder_oncpu(holder)) {
+            /*
+             * Spin (once per acquire) without the spinlock,
+             * just watching for the holder to change.
+             */
+            spinlock_release(&lock->spinlock);
+            for (i=0; i<LOCK_SPIN_MAX && lock->holder == holder; i++) {
+              /* nothing */
+            }
+            spun = true;
+            spinlock_acquire(&lock->spinlock);
+            continue;
+          }
+          blocked = true;
+          if (pi_enabled) {
+            spinlock_acquire(&pi_lock);
+            lock_addwaiter(lock);
+            spinlock_release(&pi_lock);
+          }
           wchan_lock(lock->wchan);
           spinlock_release(&lock->spinlock);
           wchan_sleep(lock->wchan);
           spinlock_acquire(&lock->spinlock);
         }
         KASSERT(lock->holder == NULL);
-        lock->holder = curthread;
+        if (curthread->t_waitlock != NULL || lock->lk_nwaiters > 0) {
+          spinlock_acquire(&pi_lock);
+          if (curthread->t_waitlock != NULL) {
+            KASSERT(curthread->t_waitlock == lock);
+            lock->lk_waiters[curthread->t_waitprio]--;
+            lock->lk_nwaiters--;
+            curthread->t_waitlock = NULL;
+            curthread->t_waitprio = SCHED_NOPRIO;
+          }
+          lock->holder = curthread;
+          /* the remaining sleepers now wait on us */
+          prio = lock_bestwaiter(lock);
+          if (prio < curthread->t_lentpriority) {
+            thread_lendpriority(curthread, prio);
+          }
+          spinlock_release(&pi_lock);
+        }
+        else {
+          lock->holder = curthread;
+        }
+        lock->lk_heldnext = curthread->t_heldlocks;
+        curthread->t_heldlocks = lock;
+        if (lock->lk_adaptive) {
+          if (blocked) {
+            lock->lk_blocks++;
+          }
+          else if (spun) {
+            lock->lk_spins++;
+          }
+        }
         spinlock_release(&lock->spinlock);
+
+        if (lock_timed(lock)) {
+          lockstat_acquired(&lock->lk_lockstat, lock->lk_name, waitstart,
+                            spun || blocked);
+        }
 }
 
 void
 lock_release(struct lock *lock)
 {
+        struct lock **lp;
+
         // Write this
         KASSERT(lock_do_i_hold(lock));
+        if (lock_timed(lock)) {
+          /* Only the holder touches these; no need to lock. */
+          lockstat_releasing(&lock->lk_lockstat);
+        }
         spinlock_acquire(&lock->spinlock);
-        lock->holder = NULL;
+        for (lp = &curthread->t_heldlocks; *lp != lock;
+             lp = &(*lp)->lk_heldnext) {
+          KASSERT(*lp != NULL);
+        }
+        *lp = lock->lk_heldnext;
+        lock->lk_heldnext = NULL;
+        /*
+         * If nobody is waiting and nothing was lent to us, there's
+         * nothing to give back. t_lentpriority is read unlocked: it
+         * can only go up behind our back through some other lock we
+         * still hold, and then we're still owing it anyway.
+         */
+        if (lock->lk_nwaiters > 0 ||
+            curthread->t_lentpriority != SCHED_NOPRIO) {
+          spinlock_acquire(&pi_lock);
+          lock->holder = NULL;
+          lock_unlend();
+          spinlock_release(&pi_lock);
+        }
+        else {
+          lock->holder = NULL;
+        }
         wchan_wakeone(lock->wchan);
         spinlock_release(&lock->spinlock);
 }
 
+/*
+ * Print the statistics of every adaptive lock. They are read without
+ * the locks' spinlocks; they're only statistics.
+ */
+void
+lock_printstats(void)
+{
+        struct lock *lock;
+        struct lockstat *ls;
+        unsigned long avg;
+
+        kprintf("%-16s %8s %8s %8s %10s %10s\n", "lock", "acquires",
+                "spun", "blocked", "avghold_us", "maxhold_us");
+        spinlock_acquire(&adaptive_locks_lock);
+        for (lock = adaptive_locks; lock != NULL; lock = lock->lk_next) {
+                ls = &lock->lk_lockstat;
+                avg = ls->ls_acquires == 0 ? 0 :
+                        (unsigned long)(ls->ls_holdtotal /
+                                        ls->ls_acquires / 1000);
+                kprintf("%-16s %8u %8u %8u %10lu %10lu\n", lock->lk_name,
+                        ls->ls_acquires, lock->lk_spins, lock->lk_blocks,
+                        avg, (unsigned long)(ls->ls_holdmax / 1000));
+        }
+        spinlock_release(&adaptive_locks_lock);
+}
+
 bool
 lock_do_i_hold(struct lock *lock)
 {
@@ -281,6 +706,24 @@ cv_wait(struct cv *cv, struct lock *lock)
         lock_acquire(lock);
 }
 
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks)
+{
+        struct timedwait tw;
+        int result;
+
+        KASSERT(lock->holder == curthread);
+        wchan_lock(cv->wchan);
+        /* the callout can't get at the channel until we're asleep */
+        timedwait_start(&tw, cv->wchan, ticks);
+        lock_release(lock);
+        wchan_sleep(cv->wchan);
+        timedwait_finish(&tw);
+        result = tw.tw_expired ? ETIMEDOUT : 0;
+        lock_acquire(lock);
+        return result;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
@@ -294,3 +737,227 @@ cv_broadcast(struct cv *cv, struct lock *lock)
         KASSERT(lock->holder == curthread);
         wchan_wakeall(cv->wchan);
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rw;
+
+        rw = kmalloc(sizeof(struct rwlock));
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rw_name = kstrdup(name);
+        if (rw->rw_name == NULL) {
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_readwchan = wchan_create(rw->rw_name);
+        if (rw->rw_readwchan == NULL) {
+                kfree(rw->rw_name);
+                kfree(rw);
+                return NULL;
+        }
+        rw->rw_writewchan = wchan_create(rw->rw_name);
+        if (rw->rw_writewchan == NULL) {
+                wchan_destroy(rw->rw_readwchan);
+                kfree(rw->rw_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        spinlock_init(&rw->rw_lock);
+        rw->rw_readers = 0;
+        rw->rw_waitingwriters = 0;
+        rw->rw_writer = NULL;
+        rw->rw_upgrader = NULL;
+
+        return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_readers == 0);
+        KASSERT(rw->rw_writer == NULL);
+        KASSERT(rw->rw_waitingwriters == 0);
+
+        spinlock_cleanup(&rw->rw_lock);
+        wchan_destroy(rw->rw_readwchan);
+        wchan_destroy(rw->rw_writewchan);
+        kfree(rw->rw_name);
+        kfree(rw);
+}
+
+/*
+ * Sleep on WC, dropping the rwlock's spinlock meanwhile. The same
+ * handoff lock_acquire uses: lock the channel before letting go of
+ * the spinlock so a wakeup can't slip in between.
+ */
+static
+void
+rwlock_sleep(struct rwlock *rw, struct wchan *wc)
+{
+        wchan_lock(wc);
+        spinlock_release(&rw->rw_lock);
+        wchan_sleep(wc);
+        spinlock_acquire(&rw->rw_lock);
+}
+
+/*
+ * Wake whoever should go next after a hold has been given up: a
+ * pending upgrader, else a writer, once the readers have drained;
+ * readers only if no writer is waiting. Spinlock must be held.
+ */
+static
+void
+rwlock_wakeup(struct rwlock *rw)
+{
+        if (rw->rw_upgrader != NULL) {
+                /* the upgrader may be anywhere on the channel */
+                if (rw->rw_readers == 0) {
+                        wchan_wakeall(rw->rw_writewchan);
+                }
+        }
+        else if (rw->rw_waitingwriters > 0) {
+                if (rw->rw_readers == 0) {
+                        wchan_wakeone(rw->rw_writewchan);
+                }
+        }
+        else {
+                wchan_wakeall(rw->rw_readwchan);
+        }
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_writer != curthread);
+        KASSERT(!curthread->t_in_interrupt);
+
+        spinlock_acquire(&rw->rw_lock);
+        while (rw->rw_writer != NULL || rw->rw_waitingwriters > 0) {
+                rwlock_sleep(rw, rw->rw_readwchan);
+        }
+        rw->rw_readers++;
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_readers > 0);
+        rw->rw_readers--;
+        rwlock_wakeup(rw);
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_writer != curthread);
+        KASSERT(!curthread->t_in_interrupt);
+
+        spinlock_acquire(&rw->rw_lock);
+        rw->rw_waitingwriters++;
+        while (rw->rw_writer != NULL || rw->rw_readers > 0 ||
+               rw->rw_upgrader != NULL) {
+                rwlock_sleep(rw, rw->rw_writewchan);
+        }
+        rw->rw_waitingwriters--;
+        rw->rw_writer = curthread;
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_writer == curthread);
+
+        spinlock_acquire(&rw->rw_lock);
+        rw->rw_writer = NULL;
+        rwlock_wakeup(rw);
+        spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_upgrade(struct rwlock *rw)
+{
+        bool atomic;
+
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_writer != curthread);
+
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_readers > 0);
+        rw->rw_readers--;
+        rw->rw_waitingwriters++;
+        if (rw->rw_upgrader == NULL) {
+                /*
+                 * Claim the lock ahead of ordinary writers: they
+                 * can't get in while rw_upgrader is set, so nothing
+                 * can change between our read and our write.
+                 */
+                atomic = true;
+                rw->rw_upgrader = curthread;
+                while (rw->rw_readers > 0) {
+                        rwlock_sleep(rw, rw->rw_writewchan);
+                }
+                rw->rw_upgrader = NULL;
+        }
+        else {
+                /*
+                 * Someone else is already upgrading; if we kept our
+                 * read hold both of us would wait forever. We've
+                 * given it up, so just queue as a writer.
+                 */
+                atomic = false;
+                rwlock_wakeup(rw);
+                while (rw->rw_writer != NULL || rw->rw_readers > 0 ||
+                       rw->rw_upgrader != NULL) {
+                        rwlock_sleep(rw, rw->rw_writewchan);
+                }
+        }
+        KASSERT(rw->rw_writer == NULL);
+        rw->rw_waitingwriters--;
+        rw->rw_writer = curthread;
+        spinlock_release(&rw->rw_lock);
+
+        return atomic;
+}
+
+void
+rwlock_downgrade(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_writer == curthread);
+
+        spinlock_acquire(&rw->rw_lock);
+        rw->rw_writer = NULL;
+        rw->rw_readers++;
+        if (rw->rw_waitingwriters == 0) {
+                /* other readers can come in alongside us */
+                wchan_wakeall(rw->rw_readwchan);
+        }
+        spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        return rw->rw_writer == curthread;
+}
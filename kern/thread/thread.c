@@ -50,6 +50,7 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <clock.h>
 
 #include "opt-synchprobs.h"
 
@@ -57,6 +58,46 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Number of exited threads (and their stacks) each cpu keeps around
+ * for reuse by thread_fork, instead of freeing them in exorcise().
+ */
+#define THREAD_CACHE_MAX 4
+
+/*
+ * Multi-level feedback queue parameters.
+ *
+ * A thread's allotment at a level is the number of hardclocks it may
+ * run there, over however many turns, before it is moved down a
+ * level. Lower levels get longer allotments. Every
+ * SCHED_BOOST_HARDCLOCKS everything runnable is moved back to the top
+ * so that CPU-bound threads can't starve.
+ */
+#define SCHED_ALLOTMENT(prio)	(2U << (prio))
+#define SCHED_BOOST_HARDCLOCKS	HZ
+
+/*
+ * Timeslice: hardclocks a thread may run before it is preempted in
+ * favour of another thread of the same priority. Lower levels run
+ * longer at a time, since they're there for being CPU-bound.
+ */
+#define SCHED_TIMESLICE(prio)	(1U << (prio))
+
+/*
+ * How long an idle cpu sleeps before its timer goes off anyway. Work
+ * arriving for it, or for a peer it could steal from, wakes it with
+ * an IPI, so this is only a backstop.
+ */
+#define SCHED_IDLE_HARDCLOCKS	HZ
+
+/* Work stealing thresholds; see thread_steal(). */
+#define STEAL_MIN_QUEUE		2
+#define STEAL_FORCE_QUEUE	4
+#define STEAL_HOT_HARDCLOCKS	2
+
+/* False for plain round-robin. */
+static bool sched_mlfq = true;
+
 /* Wait channel. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -111,6 +152,49 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Set up the fields of a new thread, other than its name and stack.
+ * Used both for freshly allocated threads and for ones coming out of
+ * the per-cpu thread cache.
+ */
+static
+void
+thread_initfields(struct thread *thread)
+{
+	thread->t_wchan_name = "NEW";
+	thread->t_state = S_READY;
+
+	/* Thread subsystem fields */
+	thread_machdep_init(&thread->t_machdep);
+	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_context = NULL;
+	thread->t_cpu = NULL;
+	thread->t_proc = NULL;
+
+	/* Interrupt state fields */
+	thread->t_in_interrupt = false;
+	thread->t_intr_fromuser = false;
+	thread->t_curspl = IPL_HIGH;
+	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+
+	/* Scheduler fields; new threads start at the top */
+	thread->t_priority = 0;
+	thread->t_levelticks = 0;
+	thread->t_cputicks = 0;
+	thread->t_lastran = 0;
+	thread->t_sliceticks = 0;
+
+	/* Priority inheritance fields */
+	thread->t_lentpriority = SCHED_NOPRIO;
+	thread->t_waitlock = NULL;
+	thread->t_waitprio = SCHED_NOPRIO;
+	thread->t_heldlocks = NULL;
+
+	bzero(&thread->t_usage, sizeof(thread->t_usage));
+
+	/* If you add to struct thread, be sure to initialize here */
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -133,23 +217,8 @@ thread_create(const char *name)
 		kfree(thread);
 		return NULL;
 	}
-	thread->t_wchan_name = "NEW";
-	thread->t_state = S_READY;
-
-	/* Thread subsystem fields */
-	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
 	thread->t_stack = NULL;
-	thread->t_context = NULL;
-	thread->t_cpu = NULL;
-	thread->t_proc = NULL;
-
-	/* Interrupt state fields */
-	thread->t_in_interrupt = false;
-	thread->t_curspl = IPL_HIGH;
-	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
-
-	/* If you add to struct thread, be sure to initialize here */
+	thread_initfields(thread);
 
 	return thread;
 }
@@ -180,10 +249,19 @@ cpu_create(unsigned hardware_number)
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
+	c->c_lastboost = 0;
+
+	threadlist_init(&c->c_threadcache);
+	c->c_threadcache_hits = 0;
+	c->c_threadcache_misses = 0;
+	c->c_stolen = 0;
+	c->c_steals = 0;
+	c->c_stealmisses = 0;
+	c->c_tickless = false;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	ticketlock_init(&c->c_runqueue_lock, "runqueue");
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -262,11 +340,80 @@ thread_destroy(struct thread *thread)
 	kfree(thread);
 }
 
+/*
+ * Put a dead thread in this cpu's thread cache, so thread_fork can
+ * reuse it and its stack, or destroy it if the cache is full. Only
+ * the name is freed; the rest is reinitialized on the way back out.
+ *
+ * Boot threads for secondary cpus have a stack and can be cached
+ * like any other; the boot cpu's original thread has none and can't.
+ *
+ * Must be called with interrupts off, since the cache is per-cpu.
+ */
+static
+void
+thread_recycle(struct thread *thread)
+{
+	KASSERT(thread->t_proc == NULL);
+	KASSERT(curthread->t_curspl > 0);
+
+	if (thread->t_stack == NULL ||
+	    curcpu->c_threadcache.tl_count >= THREAD_CACHE_MAX) {
+		thread_destroy(thread);
+		return;
+	}
+
+	thread_checkstack(thread);
+	thread_machdep_cleanup(&thread->t_machdep);
+	kfree(thread->t_name);
+	thread->t_name = NULL;
+	thread->t_wchan_name = "CACHED";
+	threadlist_addhead(&curcpu->c_threadcache, thread);
+}
+
+/*
+ * Get a thread from this cpu's thread cache, if there is one, and
+ * set it up afresh with name NAME. Returns NULL if the cache is empty
+ * or we're out of memory; the caller then creates a thread the slow
+ * way.
+ */
+static
+struct thread *
+thread_cache_get(const char *name)
+{
+	struct thread *thread;
+	int spl;
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	if (thread == NULL) {
+		curcpu->c_threadcache_misses++;
+	}
+	else {
+		curcpu->c_threadcache_hits++;
+	}
+	splx(spl);
+
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	thread->t_name = kstrdup(name);
+	if (thread->t_name == NULL) {
+		thread_destroy(thread);
+		return NULL;
+	}
+	thread_initfields(thread);
+	thread_checkstack_init(thread);
+	return thread;
+}
+
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
  * need to have thread_destroy called on them.)
  *
- * The list of zombies is per-cpu.
+ * The list of zombies is per-cpu. The dead threads are recycled into
+ * the per-cpu thread cache where possible.
  */
 static
 void
@@ -277,7 +424,7 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		thread_recycle(z);
 	}
 }
 
@@ -426,6 +573,63 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+unsigned
+thread_numcpus(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+/*
+ * Put T on run queue RQ behind every thread of the same or higher
+ * priority, so the queue stays sorted by priority and is FIFO within
+ * each level. Under plain round-robin this is just addtail.
+ *
+ * The run queue lock must be held.
+ */
+static
+void
+runqueue_insert(struct threadlist *rq, struct thread *t)
+{
+	struct threadlistnode *tln;
+
+	if (!sched_mlfq) {
+		threadlist_addtail(rq, t);
+		return;
+	}
+
+	/* Usually short; and most threads go at or near the tail */
+	for (tln = rq->tl_tail.tln_prev; tln->tln_prev != NULL;
+	     tln = tln->tln_prev) {
+		if (thread_priority(tln->tln_self) <= thread_priority(t)) {
+			threadlist_insertafter(rq, tln->tln_self, t);
+			return;
+		}
+	}
+	threadlist_addhead(rq, t);
+}
+
+/*
+ * Wake up one idle cpu other than BUSY so it can come and steal from
+ * BUSY. c_isidle is read without the other cpu's run queue lock; a
+ * wrong guess costs at most a spurious IPI or a later steal.
+ */
+static
+void
+thread_kick_idle(struct cpu *busy)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != busy && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
 /*
  * Make a thread runnable.
  *
@@ -443,14 +647,14 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
-		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+		KASSERT(ticketlock_do_i_hold(&targetcpu->c_runqueue_lock));
 	}
 	else {
-		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		ticketlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_insert(&targetcpu->c_runqueue, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -458,9 +662,17 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else if (targetcpu->c_runqueue.tl_count >= STEAL_MIN_QUEUE) {
+		/*
+		 * There's now something worth stealing. Idle cpus
+		 * don't take timer interrupts often enough to notice
+		 * by themselves, so wake one up.
+		 */
+		thread_kick_idle(targetcpu);
+	}
 
 	if (!already_have_lock) {
-		spinlock_release(&targetcpu->c_runqueue_lock);
+		ticketlock_release(&targetcpu->c_runqueue_lock);
 	}
 }
 
@@ -487,18 +699,22 @@ thread_fork(const char *name,
 	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
 #endif // UW
 
-	newthread = thread_create(name);
+	/* Reuse a dead thread and its stack if this cpu has one cached */
+	newthread = thread_cache_get(name);
 	if (newthread == NULL) {
-		return ENOMEM;
-	}
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -534,6 +750,110 @@ thread_fork(const char *name,
 	return 0;
 }
 
+/*
+ * Work stealing.
+ *
+ * Called by a cpu that has run out of work, on the way to going
+ * idle. Find the peer with the longest run queue and take the
+ * thread at its tail, which is the one that would otherwise wait
+ * longest (and, under MLFQ, the lowest priority). Returns the
+ * stolen thread, already assigned to this cpu, or NULL.
+ *
+ * Migrating threads isn't free because of cache affinity; a thread's
+ * working cache set will end up having to be moved to the other CPU.
+ * So as a hysteresis we leave a peer alone unless it has at least
+ * STEAL_MIN_QUEUE threads waiting, and we don't take a thread that
+ * ran on it within the last STEAL_HOT_HARDCLOCKS unless its queue is
+ * at least STEAL_FORCE_QUEUE long. Threads near the tail are the
+ * most likely to be hot, so we look from there towards the head for
+ * one that isn't. If the only candidates were hot, *HOTP is set: they
+ * will cool off in a few hardclocks, and the caller should try again
+ * then rather than sleep for long.
+ *
+ * Only one run queue lock is held at a time, so two idle cpus can't
+ * deadlock stealing from each other. The queue lengths are read
+ * unlocked to pick a victim; that is only a hint and is rechecked
+ * under the victim's lock.
+ *
+ * Interrupts must be off and our own run queue lock must not be held.
+ */
+static
+struct thread *
+thread_steal(bool *hotp)
+{
+	unsigned i, numcpus, count, best_count;
+	struct cpu *c, *victim;
+	struct threadlistnode *tln;
+	struct thread *t;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	*hotp = false;
+	victim = NULL;
+	best_count = STEAL_MIN_QUEUE - 1;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		count = c->c_runqueue.tl_count;
+		if (count > best_count) {
+			best_count = count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		curcpu->c_stealmisses++;
+		return NULL;
+	}
+
+	t = NULL;
+	ticketlock_acquire(&victim->c_runqueue_lock);
+	count = victim->c_runqueue.tl_count;
+	if (count >= STEAL_MIN_QUEUE) {
+		for (tln = victim->c_runqueue.tl_tail.tln_prev;
+		     tln->tln_prev != NULL; tln = tln->tln_prev) {
+			/*
+			 * The victim's curthread can be on its run
+			 * queue if it went to sleep, the victim went
+			 * idle without switching away from it, and it
+			 * was then woken up. Its stack is still in
+			 * use, so it must stay put. Likewise, leave
+			 * cache-hot threads unless the victim is
+			 * badly overloaded.
+			 */
+			if (tln->tln_self == victim->c_curthread) {
+				continue;
+			}
+			if (count < STEAL_FORCE_QUEUE &&
+			    victim->c_hardclocks - tln->tln_self->t_lastran <
+			    STEAL_HOT_HARDCLOCKS) {
+				*hotp = true;
+				continue;
+			}
+			t = tln->tln_self;
+			break;
+		}
+		if (t != NULL) {
+			threadlist_remove(&victim->c_runqueue, t);
+			victim->c_stolen++;
+			t->t_cpu = curcpu->c_self;
+			*hotp = false;
+		}
+	}
+	ticketlock_release(&victim->c_runqueue_lock);
+
+	if (t == NULL) {
+		curcpu->c_stealmisses++;
+		return NULL;
+	}
+	curcpu->c_steals++;
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+	      t->t_name, victim->c_number, curcpu->c_number);
+	return t;
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -548,6 +868,7 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc)
 {
 	struct thread *cur, *next;
+	bool hot;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -571,11 +892,19 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	thread_checkstack(cur);
 
 	/* Lock the run queue. */
-	spinlock_acquire(&curcpu->c_runqueue_lock);
+	ticketlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
-		spinlock_release(&curcpu->c_runqueue_lock);
+	/*
+	 * Micro-optimization: if nothing to do, just return. Nothing
+	 * to do includes having only lower-priority threads waiting;
+	 * since the run queue is sorted, checking the head is enough.
+	 */
+	if (newstate == S_READY &&
+	    (threadlist_isempty(&curcpu->c_runqueue) ||
+	     (sched_mlfq &&
+	      thread_priority(curcpu->c_runqueue.tl_head.tln_next->tln_self) >
+	      thread_priority(cur)))) {
+		ticketlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
@@ -585,9 +914,28 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
+		/* thread_yield from hardclock is a preemption */
+		if (cur->t_in_interrupt) {
+			cur->t_usage.tu_nivcsw++;
+		}
+		else {
+			cur->t_usage.tu_nvcsw++;
+		}
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
+		cur->t_usage.tu_nvcsw++;
+		/*
+		 * Blocking before using up the allotment is what
+		 * interactive threads do; move up a level. (A thread
+		 * blocking on a lock has already been counted as its
+		 * waiter at this new level; see thread_sleeppriority.)
+		 */
+		if (sched_mlfq && cur->t_priority > 0) {
+			cur->t_priority--;
+		}
+		cur->t_levelticks = 0;
+
 		cur->t_wchan_name = wc->wc_name;
 		/*
 		 * Add the thread to the list in the wait channel, and
@@ -611,9 +959,17 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		break;
 	}
 	cur->t_state = newstate;
+	cur->t_lastran = curcpu->c_hardclocks;
+	cur->t_sliceticks = 0;
 
 	/*
-	 * Get the next thread. While there isn't one, call md_idle().
+	 * Get the next thread. While there isn't one, try to steal
+	 * one from a busier cpu, and failing that call md_idle(),
+	 * first stretching the timer out since there's nothing for
+	 * hardclock to do here until something wakes us anyway.
+	 * (Unless the steal only failed because the threads we could
+	 * have taken were cache-hot: then keep ticking, and try again
+	 * at the next hardclock, when they may have cooled off.)
 	 * curcpu->c_isidle must be true when md_idle is
 	 * called. Unlock the runqueue while idling too, to make sure
 	 * things can be added to it.
@@ -634,12 +990,34 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	do {
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
-			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
-			spinlock_acquire(&curcpu->c_runqueue_lock);
+			ticketlock_release(&curcpu->c_runqueue_lock);
+			next = thread_steal(&hot);
+			if (next == NULL) {
+				/*
+				 * Set the timer every time round: the
+				 * interrupt path re-arms it for a single
+				 * hardclock each time it fires.
+				 */
+				if (!hot) {
+					mainbus_timer_set(
+						SCHED_IDLE_HARDCLOCKS);
+					curcpu->c_tickless = true;
+				}
+				else if (curcpu->c_tickless) {
+					mainbus_timer_set(1);
+					curcpu->c_tickless = false;
+				}
+				cpu_idle();
+			}
+			ticketlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
+	if (curcpu->c_tickless) {
+		/* Back to one interrupt per hardclock. */
+		mainbus_timer_set(1);
+		curcpu->c_tickless = false;
+	}
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -706,7 +1084,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	cur->t_state = S_RUN;
 
 	/* Unlock the run queue. */
-	spinlock_release(&curcpu->c_runqueue_lock);
+	ticketlock_release(&curcpu->c_runqueue_lock);
 
 	/* Activate our address space in the MMU. */
 	as_activate();
@@ -739,7 +1117,7 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	cur->t_state = S_RUN;
 
 	/* Release the runqueue lock acquired in thread_switch. */
-	spinlock_release(&curcpu->c_runqueue_lock);
+	ticketlock_release(&curcpu->c_runqueue_lock);
 
 	/* Activate our address space in the MMU. */
 	as_activate();
@@ -824,137 +1202,200 @@ thread_yield(void)
  *
  * This is called periodically from hardclock(). It should reshuffle
  * the current CPU's run queue by job priority.
+ *
+ * The run queue is kept sorted as threads are added to it, so all
+ * that is left to do here is the periodic priority boost: put every
+ * thread on this cpu, running or runnable, back at the top level.
+ * Sleeping threads are left alone; they move up on their own each
+ * time they block.
  */
-
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct threadlistnode *tln;
+	struct thread *t;
+
+	if (!sched_mlfq) {
+		return;
+	}
+	if (curcpu->c_hardclocks - curcpu->c_lastboost <
+	    SCHED_BOOST_HARDCLOCKS) {
+		return;
+	}
+	curcpu->c_lastboost = curcpu->c_hardclocks;
+
+	ticketlock_acquire(&curcpu->c_runqueue_lock);
+	for (tln = curcpu->c_runqueue.tl_head.tln_next; tln->tln_next != NULL;
+	     tln = tln->tln_next) {
+		t = tln->tln_self;
+		t->t_priority = 0;
+		t->t_levelticks = 0;
+	}
+	if (!curcpu->c_isidle) {
+		curthread->t_priority = 0;
+		curthread->t_levelticks = 0;
+	}
+	ticketlock_release(&curcpu->c_runqueue_lock);
+}
+
+void
+threadusage_add(struct threadusage *to, const struct threadusage *from)
+{
+	to->tu_uticks += from->tu_uticks;
+	to->tu_sticks += from->tu_sticks;
+	to->tu_faults += from->tu_faults;
+	to->tu_nvcsw += from->tu_nvcsw;
+	to->tu_nivcsw += from->tu_nivcsw;
+	to->tu_inbytes += from->tu_inbytes;
+	to->tu_outbytes += from->tu_outbytes;
 }
 
 /*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
+ * Charge the current hardclock tick to the running thread, and move
+ * it down a level once it has used up its allotment at this one.
  *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * Returns true if the thread should be preempted: something else is
+ * runnable here and either the thread's timeslice is used up or a
+ * higher-priority thread is waiting. The run queue is peeked at
+ * without the lock; the worst a stale answer does is make us yield
+ * (or not) one hardclock late, and thread_switch rechecks anyway.
  */
-void
-thread_consider_migration(void)
+bool
+thread_tick(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
+	struct thread *cur;
+	struct threadlistnode *head;
+	unsigned slice;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+	if (curcpu->c_isidle) {
+		return false;
+	}
+
+	cur = curthread;
+	cur->t_cputicks++;
+	if (cur->t_intr_fromuser) {
+		cur->t_usage.tu_uticks++;
+	}
+	else {
+		cur->t_usage.tu_sticks++;
+	}
+	cur->t_levelticks++;
+	cur->t_sliceticks++;
+	if (sched_mlfq &&
+	    cur->t_levelticks >= SCHED_ALLOTMENT(cur->t_priority)) {
+		if (cur->t_priority < SCHED_NPRIO - 1) {
+			cur->t_priority++;
 		}
-		spinlock_release(&c->c_runqueue_lock);
+		cur->t_levelticks = 0;
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
+	if (threadlist_isempty(&curcpu->c_runqueue)) {
+		return false;
 	}
+	if (!sched_mlfq) {
+		return cur->t_sliceticks >= SCHED_TIMESLICE(0);
+	}
+	head = curcpu->c_runqueue.tl_head.tln_next;
+	if (head->tln_self != NULL &&
+	    thread_priority(head->tln_self) < thread_priority(cur)) {
+		return true;
+	}
+	slice = SCHED_TIMESLICE(thread_priority(cur));
+	return cur->t_sliceticks >= slice;
+}
+
+/*
+ * Switch between MLFQ and round-robin. Existing priorities are
+ * flattened at the next boost (MLFQ) or simply ignored (round-robin).
+ */
+void
+schedule_setmlfq(bool on)
+{
+	sched_mlfq = on;
+}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+int
+thread_priority(const struct thread *t)
+{
+	if (t->t_lentpriority < t->t_priority) {
+		return t->t_lentpriority;
 	}
-	spinlock_release(&curcpu->c_runqueue_lock);
+	return t->t_priority;
+}
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+int
+thread_sleeppriority(const struct thread *t)
+{
+	int prio = t->t_priority;
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
+	/* as in the S_SLEEP case of thread_switch */
+	if (sched_mlfq && prio > 0) {
+		prio--;
+	}
+	if (t->t_lentpriority < prio) {
+		return t->t_lentpriority;
+	}
+	return prio;
+}
+
+/*
+ * A thread waiting on a run queue has to be moved when its priority
+ * changes, or the queue would no longer be sorted. The thread may be
+ * stolen by another cpu while we go for the lock, hence the retry;
+ * t_cpu only changes with the old cpu's run queue lock held.
+ */
+void
+thread_lendpriority(struct thread *t, int prio)
+{
+	struct cpu *c;
+	struct threadlistnode *tln;
+
+	KASSERT(prio >= 0 && prio <= SCHED_NOPRIO);
+
+	while (1) {
+		c = t->t_cpu;
+		ticketlock_acquire(&c->c_runqueue_lock);
+		if (t->t_cpu == c) {
+			break;
 		}
-		spinlock_release(&c->c_runqueue_lock);
+		ticketlock_release(&c->c_runqueue_lock);
 	}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+	t->t_lentpriority = prio;
+	if (sched_mlfq) {
+		for (tln = c->c_runqueue.tl_head.tln_next;
+		     tln->tln_next != NULL; tln = tln->tln_next) {
+			if (tln->tln_self == t) {
+				threadlist_remove(&c->c_runqueue, t);
+				runqueue_insert(&c->c_runqueue, t);
+				break;
+			}
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
 	}
+	ticketlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * Print per-cpu thread system statistics.
+ *
+ * The counters of other cpus are read without locking; they're only
+ * statistics, so a slightly stale value doesn't matter.
+ */
+void
+thread_printstats(void)
+{
+	unsigned i;
+	struct cpu *c;
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("cpu%u: thread cache: %u cached, %u hits, "
+			"%u misses\n", c->c_number, c->c_threadcache.tl_count,
+			c->c_threadcache_hits, c->c_threadcache_misses);
+		kprintf("cpu%u: steals: %u taken, %u missed, %u stolen "
+			"from\n", c->c_number, c->c_steals,
+			c->c_stealmisses, c->c_stolen);
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -1162,6 +1603,54 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Invalidate the N MAPPINGS on every cpu, this one included, and wait
+ * until the others have done it; after that the pages can be reused.
+ * We spin for them with interrupts on, so that two cpus doing this at
+ * once can each answer the other.
+ */
+void
+ipi_tlbshootdown_all(const struct tlbshootdown *mappings, unsigned n)
+{
+	unsigned numcpus, i, j;
+	struct cpu *c, *self;
+	bool pending;
+	int spl;
+
+	KASSERT(curthread->t_curspl == 0);
+
+	/* stay on this cpu while we send, so we know who the others are */
+	spl = splhigh();
+	self = curcpu->c_self;
+	for (j=0; j<n; j++) {
+		vm_tlbshootdown(&mappings[j]);
+	}
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == self) {
+			continue;
+		}
+		for (j=0; j<n; j++) {
+			ipi_tlbshootdown(c, &mappings[j]);
+		}
+	}
+	splx(spl);
+
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == self) {
+			continue;
+		}
+		do {
+			spinlock_acquire(&c->c_ipi_lock);
+			pending = (c->c_ipi_pending &
+				   ((uint32_t)1 << IPI_TLBSHOOTDOWN)) != 0;
+			spinlock_release(&c->c_ipi_lock);
+		} while (pending);
+	}
+}
+
 void
 interprocessor_interrupt(void)
 {
@@ -1177,12 +1666,12 @@ interprocessor_interrupt(void)
 	}
 	if (bits & (1U << IPI_OFFLINE)) {
 		/* offline request */
-		spinlock_acquire(&curcpu->c_runqueue_lock);
+		ticketlock_acquire(&curcpu->c_runqueue_lock);
 		if (!curcpu->c_isidle) {
 			kprintf("cpu%d: offline: warning: not idle\n",
 				curcpu->c_number);
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+		ticketlock_release(&curcpu->c_runqueue_lock);
 		kprintf("cpu%d: offline.\n", curcpu->c_number);
 		cpu_halt();
 	}
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <ticketlock.h>
+#include <current.h>	/* for curcpu */
+
+/*
+ * Ticket locks.
+ */
+
+#if OPT_TICKETSTATS
+/*
+ * Every ticket lock that has been acquired at least once. Locks are
+ * put on the list on their first acquire rather than in init, so
+ * statically initialized ones show up too.
+ */
+static struct ticketlock *ticketlock_statlist;
+static struct spinlock ticketlock_statlist_lock = SPINLOCK_INITIALIZER;
+#endif
+
+/*
+ * Initialize ticket lock.
+ */
+void
+ticketlock_init(struct ticketlock *tl, const char *name)
+{
+	spinlock_data_set(&tl->tl_next, 0);
+	spinlock_data_set(&tl->tl_serving, 0);
+	tl->tl_holder = NULL;
+	tl->tl_name = name;
+#if OPT_TICKETSTATS
+	tl->tl_statnext = NULL;
+	tl->tl_statlisted = false;
+	tl->tl_spins = 0;
+#endif
+#if OPT_TICKETSTATS || OPT_LOCKSTAT
+	lockstat_init(&tl->tl_lockstat);
+#endif
+}
+
+/*
+ * Clean up ticket lock.
+ */
+void
+ticketlock_cleanup(struct ticketlock *tl)
+{
+#if OPT_TICKETSTATS
+	struct ticketlock **tp;
+#endif
+
+	KASSERT(tl->tl_holder == NULL);
+	KASSERT(spinlock_data_get(&tl->tl_next) ==
+		spinlock_data_get(&tl->tl_serving));
+
+#if OPT_TICKETSTATS
+	if (tl->tl_statlisted) {
+		spinlock_acquire(&ticketlock_statlist_lock);
+		for (tp = &ticketlock_statlist; *tp != tl;
+		     tp = &(*tp)->tl_statnext) {
+			KASSERT(*tp != NULL);
+		}
+		*tp = tl->tl_statnext;
+		spinlock_release(&ticketlock_statlist_lock);
+	}
+#endif
+#if OPT_TICKETSTATS || OPT_LOCKSTAT
+	lockstat_cleanup(&tl->tl_lockstat);
+#endif
+}
+
+/*
+ * Get the lock.
+ *
+ * As with spinlocks, disable interrupts first. Then take a ticket
+ * and wait for our turn. The wait only reads, so it doesn't make
+ * the bus traffic test-and-set does.
+ */
+void
+ticketlock_acquire(struct ticketlock *tl)
+{
+	struct cpu *mycpu;
+	spinlock_data_t ticket;
+#if OPT_TICKETSTATS
+	unsigned long spins = 0;
+#endif
+#if OPT_TICKETSTATS || OPT_LOCKSTAT
+	uint64_t waitstart = 0;
+	bool contended;
+#endif
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		mycpu = curcpu->c_self;
+		if (tl->tl_holder == mycpu) {
+			panic("Deadlock on ticket lock %s\n", tl->tl_name);
+		}
+	}
+	else {
+		mycpu = NULL;
+	}
+
+	ticket = spinlock_data_fetchinc(&tl->tl_next);
+#if OPT_TICKETSTATS || OPT_LOCKSTAT
+	contended = spinlock_data_get(&tl->tl_serving) != ticket;
+#if OPT_LOCKSTAT
+	if (contended) {
+		waitstart = lockstat_now();
+	}
+#endif
+#endif
+	while (spinlock_data_get(&tl->tl_serving) != ticket) {
+#if OPT_TICKETSTATS
+		spins++;
+#endif
+	}
+
+	tl->tl_holder = mycpu;
+
+#if OPT_TICKETSTATS
+	tl->tl_spins += spins;
+	if (!tl->tl_statlisted) {
+		spinlock_acquire(&ticketlock_statlist_lock);
+		tl->tl_statnext = ticketlock_statlist;
+		ticketlock_statlist = tl;
+		tl->tl_statlisted = true;
+		spinlock_release(&ticketlock_statlist_lock);
+	}
+#endif
+#if OPT_TICKETSTATS || OPT_LOCKSTAT
+	lockstat_acquired(&tl->tl_lockstat, tl->tl_name, waitstart,
+			  contended);
+#endif
+}
+
+/*
+ * Release the lock: let the next ticket in. Only the holder writes
+ * tl_serving, so a plain store is enough.
+ */
+void
+ticketlock_release(struct ticketlock *tl)
+{
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		KASSERT(tl->tl_holder == curcpu->c_self);
+	}
+
+#if OPT_TICKETSTATS || OPT_LOCKSTAT
+	lockstat_releasing(&tl->tl_lockstat);
+#endif
+
+	tl->tl_holder = NULL;
+	spinlock_data_set(&tl->tl_serving,
+			  spinlock_data_get(&tl->tl_serving) + 1);
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+/*
+ * Check if the current cpu holds the lock.
+ */
+bool
+ticketlock_do_i_hold(struct ticketlock *tl)
+{
+	if (!CURCPU_EXISTS()) {
+		return true;
+	}
+
+	/* Assume we can read tl_holder atomically enough for this to work */
+	return (tl->tl_holder == curcpu->c_self);
+}
+
+/*
+ * Print the statistics of every ticket lock used so far. They are
+ * read without the locks themselves; they're only statistics.
+ */
+void
+ticketlock_printstats(void)
+{
+#if OPT_TICKETSTATS
+	struct ticketlock *tl;
+
+	kprintf("%-16s %10s %10s %12s %10s\n", "ticketlock", "acquires",
+		"contended", "spins", "maxhold_ns");
+	spinlock_acquire(&ticketlock_statlist_lock);
+	for (tl = ticketlock_statlist; tl != NULL; tl = tl->tl_statnext) {
+		kprintf("%-16s %10u %10u %12lu %10lu\n", tl->tl_name,
+			tl->tl_lockstat.ls_acquires,
+			tl->tl_lockstat.ls_contended, tl->tl_spins,
+			(unsigned long)tl->tl_lockstat.ls_holdmax);
+	}
+	spinlock_release(&ticketlock_statlist_lock);
+#else
+	kprintf("Ticket lock statistics not compiled in "
+		"(options ticketstats)\n");
+#endif
+}
@@ -43,6 +43,7 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <addrspace.h>
 
 /*
  * Structure for a single named device.
@@ -103,7 +104,7 @@ vfs_bootstrap(void)
 		panic("vfs: Could not create knowndevs array\n");
 	}
 
-	vfs_biglock = lock_create("vfs_biglock");
+	vfs_biglock = lock_create_adaptive("vfs_biglock");
 	if (vfs_biglock==NULL) {
 		panic("vfs: Could not create vfs big lock\n");
 	}
@@ -557,6 +558,9 @@ vfs_unmount(const char *devname)
 	struct knowndev *kd;
 	int result;
 
+	/* cached executables hold vnodes; let go of them */
+	elfcache_flush();
+
 	vfs_biglock_acquire();
 
 	result = findmount(devname, &kd);
@@ -603,6 +607,8 @@ vfs_unmountall(void)
 	unsigned i, num;
 	int result;
 
+	elfcache_flush();
+
 	vfs_biglock_acquire();
 
 	num = knowndevarray_num(knowndevs);
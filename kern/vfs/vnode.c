@@ -34,6 +34,9 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <synch.h>
+#include <uio.h>
+#include <current.h>
+#include <thread.h>
 #include <vfs.h>
 #include <vnode.h>
 
@@ -49,8 +52,9 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	KASSERT(ops!=NULL);
 
 	vn->vn_ops = ops;
-	vn->vn_refcount = 1;
+	atomic_init(&vn->vn_refcount, 1);
 	vn->vn_opencount = 0;
+	atomic_init(&vn->vn_writegen, 0);
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
 	return 0;
@@ -63,37 +67,112 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 void
 vnode_cleanup(struct vnode *vn)
 {
-	KASSERT(vn->vn_refcount==1);
+	KASSERT(atomic_get(&vn->vn_refcount)==1);
 	KASSERT(vn->vn_opencount==0);
 
 	vn->vn_ops = NULL;
-	vn->vn_refcount = 0;
+	atomic_set(&vn->vn_refcount, 0);
 	vn->vn_opencount = 0;
 	vn->vn_fs = NULL;
 	vn->vn_data = NULL;
 }
 
 
+/*
+ * Read, charging what was read to the current thread.
+ */
+int
+vnode_read(struct vnode *vn, struct uio *uio)
+{
+	size_t resid = uio->uio_resid;
+	int result;
+
+	result = __VOP(vn, read)(vn, uio);
+	curthread->t_usage.tu_inbytes += resid - uio->uio_resid;
+	return result;
+}
+
+/*
+ * Write and truncate, counting the call in vn_writegen. The count goes
+ * up after the filesystem is done, so that whoever reads the count
+ * before reading the file sees it change if the read might have
+ * overlapped the write.
+ */
+int
+vnode_write(struct vnode *vn, struct uio *uio)
+{
+	size_t resid = uio->uio_resid;
+	int result;
+
+	result = __VOP(vn, write)(vn, uio);
+	atomic_add(&vn->vn_writegen, 1);
+	curthread->t_usage.tu_outbytes += resid - uio->uio_resid;
+	return result;
+}
+
+int
+vnode_truncate(struct vnode *vn, off_t pos)
+{
+	int result;
+
+	result = __VOP(vn, truncate)(vn, pos);
+	atomic_add(&vn->vn_writegen, 1);
+	return result;
+}
+
+unsigned
+vnode_writegen(struct vnode *vn)
+{
+	return atomic_get(&vn->vn_writegen);
+}
+
 /*
  * Increment refcount.
  * Called by VOP_INCREF.
+ *
+ * The caller already has a reference, so the vnode can't be reclaimed
+ * under us and no lock is needed. (New references to vnodes that
+ * have none come from the filesystems' own tables, under the big
+ * lock.)
  */
 void
 vnode_incref(struct vnode *vn)
 {
 	KASSERT(vn != NULL);
 
-	vfs_biglock_acquire();
-
-	vn->vn_refcount++;
+	atomic_add(&vn->vn_refcount, 1);
+}
 
-	vfs_biglock_release();
+/*
+ * Drop a reference unless it's the last one. Returns true if it did.
+ */
+static
+bool
+vnode_decref_notlast(struct vnode *vn)
+{
+	int old, prev;
+
+	old = atomic_get(&vn->vn_refcount);
+	KASSERT(old > 0);
+	while (old > 1) {
+		prev = atomic_cas(&vn->vn_refcount, old, old - 1);
+		if (prev == old) {
+			return true;
+		}
+		old = prev;
+	}
+	return false;
 }
 
 /*
  * Decrement refcount.
  * Called by VOP_DECREF.
  * Calls VOP_RECLAIM if the refcount hits zero.
+ *
+ * Dropping anything but the last reference is done lock-free. The
+ * last one is dropped under the big lock, as before, trying the
+ * lock-free way again there since the count may have gone up
+ * meanwhile.
  */
 void
 vnode_decref(struct vnode *vn)
@@ -102,13 +181,13 @@ vnode_decref(struct vnode *vn)
 
 	KASSERT(vn != NULL);
 
+	if (vnode_decref_notlast(vn)) {
+		return;
+	}
+
 	vfs_biglock_acquire();
 
-	KASSERT(vn->vn_refcount>0);
-	if (vn->vn_refcount>1) {
-		vn->vn_refcount--;
-	}
-	else {
+	if (!vnode_decref_notlast(vn)) {
 		result = VOP_RECLAIM(vn);
 		if (result != 0 && result != EBUSY) {
 			// XXX: lame.
@@ -173,6 +252,8 @@ vnode_decopen(struct vnode *vn)
 void
 vnode_check(struct vnode *v, const char *opstr)
 {
+	int refcount;
+
 	vfs_biglock_acquire();
 
 	if (v == NULL) {
@@ -202,16 +283,17 @@ vnode_check(struct vnode *v, const char *opstr)
 		panic("vnode_check: vop_%s: deadbeef fs pointer\n", opstr);
 	}
 
-	if (v->vn_refcount < 0) {
+	refcount = atomic_get(&v->vn_refcount);
+	if (refcount < 0) {
 		panic("vnode_check: vop_%s: negative refcount %d\n", opstr,
-		      v->vn_refcount);
+		      refcount);
 	}
-	else if (v->vn_refcount == 0 && strcmp(opstr, "reclaim")) {
+	else if (refcount == 0 && strcmp(opstr, "reclaim")) {
 		panic("vnode_check: vop_%s: zero refcount\n", opstr);
 	}
-	else if (v->vn_refcount > 0x100000) {
+	else if (refcount > 0x100000) {
 		kprintf("vnode_check: vop_%s: warning: large refcount %d\n", 
-			opstr, v->vn_refcount);
+			opstr, refcount);
 	}
 
 	if (v->vn_opencount < 0) {
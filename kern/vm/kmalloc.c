@@ -29,8 +29,10 @@
 
 #include <types.h>
 #include <lib.h>
-#include <spinlock.h>
+#include <ticketlock.h>
 #include <vm.h>
+#include <clock.h>
+#include "opt-kmallocprof.h"
 
 /*
  * Kernel malloc.
@@ -195,7 +197,7 @@ static struct pageref *allbase;
  * OS/161 performance and scalability aren't super-critical.
  */
 
-static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+static struct ticketlock kmalloc_spinlock = TICKETLOCK_INITIALIZER("kmalloc");
 
 ////////////////////////////////////////
 
@@ -216,7 +218,7 @@ checksubpage(struct pageref *pr)
 	int blktype;
 	int nfree=0;
 
-	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(ticketlock_do_i_hold(&kmalloc_spinlock));
 
 	if (pr->freelist_offset == INVALID_OFFSET) {
 		KASSERT(pr->nfree==0);
@@ -255,7 +257,7 @@ checksubpages(void)
 	int i;
 	unsigned sc=0, ac=0;
 
-	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(ticketlock_do_i_hold(&kmalloc_spinlock));
 
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
@@ -279,6 +281,347 @@ checksubpages(void)
 
 ////////////////////////////////////////
 
+#if OPT_KMALLOCPROF
+/*
+ * Allocation profiling by call site.
+ *
+ * Each kmalloc is charged to the return address of the kmalloc call,
+ * which can be turned back into a file and line with addr2line. Call
+ * sites are kept in a small open-addressed hash table; slot 0 is
+ * reserved and collects everything once the table fills up.
+ *
+ * To charge the free back to the right site, we remember the site
+ * index of every subpage block in a byte array parallel to the
+ * pageref table, and of every whole-page allocation in a small table
+ * of its own. Neither can be allocated with kmalloc, so both live in
+ * the BSS. The subpage map is 64k; this is why the profiler is a
+ * kernel config option rather than always on.
+ *
+ * All of this is protected by kmalloc_spinlock.
+ */
+
+#define KMPROF_NSITES	128	/* must be a power of 2, at most 256 */
+#define KMPROF_NBIG	64	/* whole-page allocations we can track */
+#define KMPROF_OVERFLOW	0	/* site index for untrackable allocations */
+
+struct kmprof_site {
+	vaddr_t ks_callsite;	/* return address of kmalloc call */
+	unsigned ks_allocs;	/* total allocations */
+	unsigned ks_frees;	/* total frees */
+	unsigned ks_liveobjs;	/* objects currently allocated */
+	size_t ks_livebytes;	/* bytes of heap currently held */
+	size_t ks_peakbytes;	/* high-water mark of ks_livebytes */
+};
+
+struct kmprof_big {
+	vaddr_t kb_addr;	/* page address, or 0 if slot unused */
+	unsigned kb_npages;
+	uint8_t kb_site;
+};
+
+static struct kmprof_site kmprof_sites[KMPROF_NSITES];
+static struct kmprof_big kmprof_bigs[KMPROF_NBIG];
+static uint8_t kmprof_blocksite[NPAGEREFS][PAGE_SIZE / SMALLEST_SUBPAGE_SIZE];
+
+/* per size class: bytes asked for vs. bytes handed out */
+static uint64_t kmprof_requested[NSIZES];
+static uint64_t kmprof_granted[NSIZES];
+
+/* when the counters were last reset, for the allocation rate */
+static time_t kmprof_startsecs;
+static uint32_t kmprof_startnsecs;
+
+/*
+ * Find (or claim) the table slot for CALLSITE.
+ */
+static
+unsigned
+kmprof_site_index(vaddr_t callsite)
+{
+	unsigned i, n;
+
+	KASSERT(ticketlock_do_i_hold(&kmalloc_spinlock));
+
+	i = (callsite >> 2) & (KMPROF_NSITES - 1);
+	for (n = 0; n < KMPROF_NSITES; n++) {
+		if (i != KMPROF_OVERFLOW) {
+			if (kmprof_sites[i].ks_callsite == callsite) {
+				return i;
+			}
+			if (kmprof_sites[i].ks_callsite == 0) {
+				kmprof_sites[i].ks_callsite = callsite;
+				return i;
+			}
+		}
+		i = (i + 1) & (KMPROF_NSITES - 1);
+	}
+	return KMPROF_OVERFLOW;
+}
+
+static
+void
+kmprof_charge(unsigned site, size_t bytes)
+{
+	struct kmprof_site *ks = &kmprof_sites[site];
+
+	ks->ks_allocs++;
+	ks->ks_liveobjs++;
+	ks->ks_livebytes += bytes;
+	if (ks->ks_livebytes > ks->ks_peakbytes) {
+		ks->ks_peakbytes = ks->ks_livebytes;
+	}
+}
+
+static
+void
+kmprof_credit(unsigned site, size_t bytes)
+{
+	struct kmprof_site *ks = &kmprof_sites[site];
+
+	ks->ks_frees++;
+	/* counters may have been reset since the allocation */
+	if (ks->ks_liveobjs > 0) {
+		ks->ks_liveobjs--;
+	}
+	ks->ks_livebytes = bytes > ks->ks_livebytes ? 0 :
+		ks->ks_livebytes - bytes;
+}
+
+/*
+ * Record a subpage allocation of SZ bytes (rounded up to its block
+ * size) at PTR in page PR.
+ */
+static
+void
+kmprof_subpage_alloc(struct pageref *pr, void *ptr, size_t sz,
+		     vaddr_t callsite)
+{
+	unsigned blktype, site, index;
+
+	KASSERT(ticketlock_do_i_hold(&kmalloc_spinlock));
+
+	blktype = PR_BLOCKTYPE(pr);
+	index = ((vaddr_t)ptr - PR_PAGEADDR(pr)) / sizes[blktype];
+	site = kmprof_site_index(callsite);
+
+	kmprof_blocksite[pr - pagerefs][index] = site;
+	kmprof_charge(site, sizes[blktype]);
+	kmprof_requested[blktype] += sz;
+	kmprof_granted[blktype] += sizes[blktype];
+}
+
+static
+void
+kmprof_subpage_free(struct pageref *pr, vaddr_t offset)
+{
+	unsigned blktype, index;
+
+	KASSERT(ticketlock_do_i_hold(&kmalloc_spinlock));
+
+	blktype = PR_BLOCKTYPE(pr);
+	index = offset / sizes[blktype];
+	kmprof_credit(kmprof_blocksite[pr - pagerefs][index], sizes[blktype]);
+}
+
+static
+void
+kmprof_big_alloc(vaddr_t addr, unsigned npages, vaddr_t callsite)
+{
+	unsigned i, site;
+
+	ticketlock_acquire(&kmalloc_spinlock);
+	site = kmprof_site_index(callsite);
+	for (i=0; i<KMPROF_NBIG; i++) {
+		if (kmprof_bigs[i].kb_addr == 0) {
+			kmprof_bigs[i].kb_addr = addr;
+			kmprof_bigs[i].kb_npages = npages;
+			kmprof_bigs[i].kb_site = site;
+			break;
+		}
+	}
+	if (i == KMPROF_NBIG) {
+		/* can't remember it, so the free won't find it either */
+		site = KMPROF_OVERFLOW;
+	}
+	kmprof_charge(site, npages * PAGE_SIZE);
+	ticketlock_release(&kmalloc_spinlock);
+}
+
+static
+void
+kmprof_big_free(vaddr_t addr)
+{
+	unsigned i;
+
+	ticketlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<KMPROF_NBIG; i++) {
+		if (kmprof_bigs[i].kb_addr == addr) {
+			kmprof_credit(kmprof_bigs[i].kb_site,
+				      kmprof_bigs[i].kb_npages * PAGE_SIZE);
+			kmprof_bigs[i].kb_addr = 0;
+			break;
+		}
+	}
+	if (i == KMPROF_NBIG) {
+		kmprof_sites[KMPROF_OVERFLOW].ks_frees++;
+	}
+	ticketlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Reset the counters. Live-object bookkeeping (which site owns which
+ * block) is kept, so frees of older allocations are still charged
+ * correctly; the live counts just start from zero again.
+ */
+void
+kheap_resetprofile(void)
+{
+	unsigned i;
+
+	gettime(&kmprof_startsecs, &kmprof_startnsecs);
+
+	ticketlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<KMPROF_NSITES; i++) {
+		kmprof_sites[i].ks_allocs = 0;
+		kmprof_sites[i].ks_frees = 0;
+		kmprof_sites[i].ks_liveobjs = 0;
+		kmprof_sites[i].ks_livebytes = 0;
+		kmprof_sites[i].ks_peakbytes = 0;
+	}
+	for (i=0; i<NSIZES; i++) {
+		kmprof_requested[i] = 0;
+		kmprof_granted[i] = 0;
+	}
+	ticketlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Print the per-site table, followed by a per-size-class histogram
+ * of how full the subpage pages are.
+ */
+void
+kheap_printprofile(void)
+{
+	struct kmprof_site *ks;
+	struct pageref *pr;
+	time_t nowsecs, secs;
+	uint32_t nownsecs, nsecs;
+	unsigned long msecs;
+	unsigned i, b, blktype, nblocks;
+	unsigned npages[NSIZES], nfree[NSIZES];
+	unsigned fill[NSIZES][4];
+
+	/*
+	 * The clock isn't available when the first allocations happen,
+	 * so until the first reset there's no interval to compute a
+	 * rate over.
+	 */
+	msecs = 0;
+	if (kmprof_startsecs != 0) {
+		gettime(&nowsecs, &nownsecs);
+		getinterval(kmprof_startsecs, kmprof_startnsecs,
+			    nowsecs, nownsecs, &secs, &nsecs);
+		msecs = secs * 1000 + nsecs / 1000000;
+		if (msecs == 0) {
+			msecs = 1;
+		}
+	}
+
+	/* print the whole thing with interrupts off */
+	ticketlock_acquire(&kmalloc_spinlock);
+
+	if (msecs == 0) {
+		kprintf("kmalloc profile since boot "
+			"(\"kmp reset\" to measure rates):\n");
+	}
+	else {
+		kprintf("kmalloc profile over %lu.%03lu seconds:\n",
+			msecs / 1000, msecs % 1000);
+	}
+	kprintf("  callsite     allocs   frees    live   livebytes"
+		"   peakbytes  allocs/s\n");
+	for (i=0; i<KMPROF_NSITES; i++) {
+		ks = &kmprof_sites[i];
+		if (ks->ks_allocs == 0 && ks->ks_liveobjs == 0 &&
+		    ks->ks_frees == 0) {
+			continue;
+		}
+		if (i == KMPROF_OVERFLOW) {
+			kprintf("  (other)   ");
+		}
+		else {
+			kprintf("  0x%08lx", (unsigned long)ks->ks_callsite);
+		}
+		kprintf(" %7u %7u %7u  %10lu  %10lu",
+			ks->ks_allocs, ks->ks_frees, ks->ks_liveobjs,
+			(unsigned long)ks->ks_livebytes,
+			(unsigned long)ks->ks_peakbytes);
+		if (msecs > 0) {
+			kprintf("  %8lu\n", (unsigned long)
+				((uint64_t)ks->ks_allocs * 1000 / msecs));
+		}
+		else {
+			kprintf("         -\n");
+		}
+	}
+
+	for (i=0; i<NSIZES; i++) {
+		npages[i] = nfree[i] = 0;
+		for (b=0; b<4; b++) {
+			fill[i][b] = 0;
+		}
+	}
+	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+		blktype = PR_BLOCKTYPE(pr);
+		nblocks = PAGE_SIZE / sizes[blktype];
+		npages[blktype]++;
+		nfree[blktype] += pr->nfree;
+		/* quartile of blocks in use; a full page lands in the top */
+		b = (nblocks - pr->nfree) * 4 / nblocks;
+		fill[blktype][b > 3 ? 3 : b]++;
+	}
+
+	kprintf("  size  pages  free blks  <25%%  <50%%  <75%%  >=75%%"
+		"  req/granted\n");
+	for (i=0; i<NSIZES; i++) {
+		kprintf("  %4lu  %5u  %9u  %4u  %4u  %4u  %5u",
+			(unsigned long)sizes[i], npages[i], nfree[i],
+			fill[i][0], fill[i][1], fill[i][2], fill[i][3]);
+		if (kmprof_granted[i] > 0) {
+			kprintf("  %3lu%%\n", (unsigned long)
+				(kmprof_requested[i] * 100 /
+				 kmprof_granted[i]));
+		}
+		else {
+			kprintf("     -\n");
+		}
+	}
+
+	ticketlock_release(&kmalloc_spinlock);
+}
+
+#else
+#define kmprof_subpage_alloc(pr, ptr, sz, callsite) \
+	((void)(pr), (void)(sz), (void)(callsite))
+#define kmprof_subpage_free(pr, offset) ((void)(pr), (void)(offset))
+
+void
+kheap_resetprofile(void)
+{
+	kprintf("kmalloc profiling not compiled in "
+		"(options kmallocprof)\n");
+}
+
+void
+kheap_printprofile(void)
+{
+	kprintf("kmalloc profiling not compiled in "
+		"(options kmallocprof)\n");
+}
+#endif /* OPT_KMALLOCPROF */
+
+////////////////////////////////////////
+
 static
 void
 dumpsubpage(struct pageref *pr)
@@ -290,7 +633,7 @@ dumpsubpage(struct pageref *pr)
 	uint32_t freemap[PAGE_SIZE / (SMALLEST_SUBPAGE_SIZE*32)];
 
 	checksubpage(pr);
-	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(ticketlock_do_i_hold(&kmalloc_spinlock));
 
 	/* clear freemap[] */
 	for (i=0; i<sizeof(freemap)/sizeof(freemap[0]); i++) {
@@ -336,7 +679,7 @@ kheap_printstats(void)
 	struct pageref *pr;
 
 	/* print the whole thing with interrupts off */
-	spinlock_acquire(&kmalloc_spinlock);
+	ticketlock_acquire(&kmalloc_spinlock);
 
 	kprintf("Subpage allocator status:\n");
 
@@ -344,7 +687,7 @@ kheap_printstats(void)
 		dumpsubpage(pr);
 	}
 
-	spinlock_release(&kmalloc_spinlock);
+	ticketlock_release(&kmalloc_spinlock);
 }
 
 ////////////////////////////////////////
@@ -394,7 +737,7 @@ int blocktype(size_t sz)
 
 static
 void *
-subpage_kmalloc(size_t sz)
+subpage_kmalloc(size_t sz, vaddr_t callsite)
 {
 	unsigned blktype;	// index into sizes[] that we're using
 	struct pageref *pr;	// pageref for page we're allocating from
@@ -402,14 +745,16 @@ subpage_kmalloc(size_t sz)
 	vaddr_t fla;		// free list entry address
 	struct freelist *volatile fl;	// free list entry
 	void *retptr;		// our result
+	size_t reqsz;		// size originally asked for
 
 	volatile int i;
 
 
 	blktype = blocktype(sz);
+	reqsz = sz;
 	sz = sizes[blktype];
 
-	spinlock_acquire(&kmalloc_spinlock);
+	ticketlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
 
@@ -443,9 +788,10 @@ subpage_kmalloc(size_t sz)
 				pr->freelist_offset = INVALID_OFFSET;
 			}
 
+			kmprof_subpage_alloc(pr, retptr, reqsz, callsite);
 			checksubpages();
 
-			spinlock_release(&kmalloc_spinlock);
+			ticketlock_release(&kmalloc_spinlock);
 			return retptr;
 		}
 	}
@@ -459,19 +805,19 @@ subpage_kmalloc(size_t sz)
 	 * Note that this means things can change behind our back...
 	 */
 
-	spinlock_release(&kmalloc_spinlock);
+	ticketlock_release(&kmalloc_spinlock);
 	prpage = alloc_kpages(1);
 	if (prpage==0) {
 		/* Out of memory. */
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n"); 
 		return NULL;
 	}
-	spinlock_acquire(&kmalloc_spinlock);
+	ticketlock_acquire(&kmalloc_spinlock);
 
 	pr = allocpageref();
 	if (pr==NULL) {
 		/* Couldn't allocate accounting space for the new page. */
-		spinlock_release(&kmalloc_spinlock);
+		ticketlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 		kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
 		return NULL;
@@ -522,7 +868,7 @@ subpage_kfree(void *ptr)
 
 	ptraddr = (vaddr_t)ptr;
 
-	spinlock_acquire(&kmalloc_spinlock);
+	ticketlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
 
@@ -541,7 +887,7 @@ subpage_kfree(void *ptr)
 
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
+		ticketlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
@@ -558,6 +904,8 @@ subpage_kfree(void *ptr)
 	 */
 	fill_deadbeef(ptr, sizes[blktype]);
 
+	kmprof_subpage_free(pr, offset);
+
 	/*
 	 * We probably ought to check for free twice by seeing if the block
 	 * is already on the free list. But that's expensive, so we don't.
@@ -579,17 +927,17 @@ subpage_kfree(void *ptr)
 		remove_lists(pr, blktype);
 		freepageref(pr);
 		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
+		ticketlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 	}
 	else {
-		spinlock_release(&kmalloc_spinlock);
+		ticketlock_release(&kmalloc_spinlock);
 	}
 
 #ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
-	spinlock_acquire(&kmalloc_spinlock);
+	ticketlock_acquire(&kmalloc_spinlock);
 	checksubpages();
-	spinlock_release(&kmalloc_spinlock);
+	ticketlock_release(&kmalloc_spinlock);
 #endif
 
 	return 0;
@@ -601,6 +949,11 @@ subpage_kfree(void *ptr)
 void *
 kmalloc(size_t sz)
 {
+	vaddr_t callsite;
+
+	/* Charge the allocation to whoever called us (for profiling) */
+	callsite = (vaddr_t)__builtin_return_address(0);
+
 	if (sz>=LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
@@ -611,11 +964,14 @@ kmalloc(size_t sz)
 		if (address==0) {
 			return NULL;
 		}
+#if OPT_KMALLOCPROF
+		kmprof_big_alloc(address, npages, callsite);
+#endif
 
 		return (void *)address;
 	}
 
-	return subpage_kmalloc(sz);
+	return subpage_kmalloc(sz, callsite);
 }
 
 void
@@ -628,6 +984,9 @@ kfree(void *ptr)
 		return;
 	} else if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+#if OPT_KMALLOCPROF
+		kmprof_big_free((vaddr_t)ptr);
+#endif
 		free_kpages((vaddr_t)ptr);
 	}
 }
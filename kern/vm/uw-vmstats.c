@@ -14,10 +14,11 @@
 #include <lib.h>
 #include <synch.h>
 #include <spl.h>
+#include <atomic.h>
 #include <uw-vmstats.h>
 
-/* Counters for tracking statistics */
-static unsigned int stats_counts[VMSTAT_COUNT];
+/* Counters for tracking statistics; atomic so incrementing needs no lock */
+static struct atomic stats_counts[VMSTAT_COUNT];
 
 struct spinlock stats_lock = SPINLOCK_INITIALIZER;
 
@@ -41,9 +42,7 @@ static const char *stats_names[] = {
 void
 vmstats_inc(unsigned int index)
 {
-    spinlock_acquire(&stats_lock);
-      _vmstats_inc(index);
-    spinlock_release(&stats_lock);
+  _vmstats_inc(index);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -65,7 +64,7 @@ void
 _vmstats_inc(unsigned int index)
 {
   KASSERT(index < VMSTAT_COUNT);
-  stats_counts[index]++;
+  atomic_add(&stats_counts[index], 1);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -81,7 +80,7 @@ _vmstats_init(void)
   }
 
   for (i=0; i<VMSTAT_COUNT; i++) {
-    stats_counts[i] = 0;
+    atomic_set(&stats_counts[i], 0);
   }
 
 }
@@ -105,15 +104,15 @@ vmstats_print(void)
 
   kprintf("VMSTATS:\n");
   for (i=0; i<VMSTAT_COUNT; i++) {
-    kprintf("VMSTAT %25s = %10d\n", stats_names[i], stats_counts[i]);
+    kprintf("VMSTAT %25s = %10d\n", stats_names[i], atomic_get(&stats_counts[i]));
   }
 
-  tlb_faults = stats_counts[VMSTAT_TLB_FAULT];
-  free_plus_replace = stats_counts[VMSTAT_TLB_FAULT_FREE] + stats_counts[VMSTAT_TLB_FAULT_REPLACE];
-  disk_plus_zeroed_plus_reload = stats_counts[VMSTAT_PAGE_FAULT_DISK] +
-    stats_counts[VMSTAT_PAGE_FAULT_ZERO] + stats_counts[VMSTAT_TLB_RELOAD];
-  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ];
-  disk_reads = stats_counts[VMSTAT_PAGE_FAULT_DISK];
+  tlb_faults = atomic_get(&stats_counts[VMSTAT_TLB_FAULT]);
+  free_plus_replace = atomic_get(&stats_counts[VMSTAT_TLB_FAULT_FREE]) + atomic_get(&stats_counts[VMSTAT_TLB_FAULT_REPLACE]);
+  disk_plus_zeroed_plus_reload = atomic_get(&stats_counts[VMSTAT_PAGE_FAULT_DISK]) +
+    atomic_get(&stats_counts[VMSTAT_PAGE_FAULT_ZERO]) + atomic_get(&stats_counts[VMSTAT_TLB_RELOAD]);
+  elf_plus_swap_reads = atomic_get(&stats_counts[VMSTAT_ELF_FILE_READ]) + atomic_get(&stats_counts[VMSTAT_SWAP_FILE_READ]);
+  disk_reads = atomic_get(&stats_counts[VMSTAT_PAGE_FAULT_DISK]);
 
   kprintf("VMSTAT TLB Faults with Free + TLB Faults with Replace = %d\n", free_plus_replace);
   if (tlb_faults != free_plus_replace) {
@@ -45,6 +45,7 @@
 #include <limits.h>
 #include <errno.h>
 #include <err.h>
+#include <spawn.h>
 
 #ifdef HOST
 #include "hostcompat.h"
@@ -307,7 +308,7 @@ docommand(char *buf)
 	int nargs, i;
 	char *s;
 	pid_t pid;
-	int status;
+	int status, result;
 	int bg=0;
 	time_t startsecs, endsecs;
 	unsigned long startnsecs, endnsecs;
@@ -354,29 +355,17 @@ docommand(char *buf)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			return _MKWAIT_EXIT(255);
-		case 0:
-			/* child */
-			execv(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
-	}
-
-	/* parent */
+	/*
+	 * posix_spawn rather than fork and execv, so the shell's address
+	 * space isn't copied only to be thrown away by execv.
+	 */
+	result = posix_spawn(&pid, args[0], NULL, NULL, args, NULL);
+	if (result) {
+		errno = result;
+		warn("%s", args[0]);
+		return _MKWAIT_EXIT(255);
+	}
+
 	if (bg) {
 		/* background this command */
 		remember_bg(pid);
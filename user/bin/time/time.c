@@ -0,0 +1,67 @@
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <spawn.h>
+#include <errno.h>
+#include <err.h>
+
+/*
+ * time - run a program and report the time and resources it used.
+ * Usage: time program [args]
+ *
+ * Like sh, takes the program's path as given. The user and system
+ * times come from hardclock sampling, so are only good to a tick.
+ * Faults are TLB misses; I/O is bytes read and written through the
+ * VFS, console included.
+ */
+
+static
+void
+printtime(const char *what, time_t sec, unsigned long usec)
+{
+	printf("%10lu.%02lu %s", (unsigned long)sec, usec / 10000, what);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct rusage ru;
+	time_t s0, s1;
+	unsigned long ns0, ns1, usec;
+	pid_t pid;
+	int status, result;
+
+	if (argc < 2) {
+		errx(1, "Usage: time program [args]");
+	}
+
+	__time(&s0, &ns0);
+	result = posix_spawn(&pid, argv[1], NULL, NULL, &argv[1], NULL);
+	if (result) {
+		errno = result;
+		err(1, "%s", argv[1]);
+	}
+	if (wait4(pid, &status, 0, &ru) < 0) {
+		err(1, "wait4");
+	}
+	__time(&s1, &ns1);
+
+	if (ns1 < ns0) {
+		ns1 += 1000000000;
+		s1--;
+	}
+	usec = (ns1 - ns0) / 1000;
+	printtime("real ", s1 - s0, usec);
+	printtime("user ", ru.ru_utime.tv_sec, ru.ru_utime.tv_usec);
+	printtime("sys\n", ru.ru_stime.tv_sec, ru.ru_stime.tv_usec);
+	printf("%10llu faults %10llu vcsw %10llu ivcsw\n",
+	       ru.ru_minflt, ru.ru_nvcsw, ru.ru_nivcsw);
+	printf("%10llu bytes in %8llu bytes out\n",
+	       ru.ru_inbytes, ru.ru_outbytes);
+
+	if (WIFEXITED(status)) {
+		return WEXITSTATUS(status);
+	}
+	return 1;
+}
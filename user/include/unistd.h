@@ -135,6 +135,23 @@ int rmdir(const char *dirname);
 
 /* Recommended. */
 int getpid(void);
+/*
+ * wait4 is waitpid that also fills in the resource usage of the child
+ * it collects. getrusage gets the usage of this process (RUSAGE_SELF)
+ * or of the children it has collected (RUSAGE_CHILDREN). struct
+ * rusage is in sys/resource.h.
+ */
+struct rusage;
+pid_t wait4(pid_t pid, int *returncode, int flags, struct rusage *usage);
+int getrusage(int who, struct rusage *usage);
+/*
+ * vfork is fork without copying the address space: the child borrows
+ * the parent's, and the parent waits until the child calls execv or
+ * _exit. The child must do nothing else. __spawn is the system call
+ * under posix_spawn; see spawn.h.
+ */
+pid_t vfork(void);
+pid_t __spawn(const char *path, char *const *argv);
 int ioctl(int filehandle, int code, void *buf);
 off_t lseek(int filehandle, off_t pos, int code);
 int fsync(int filehandle);
@@ -154,6 +171,25 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
+int futex_wait(volatile int *addr, int expected);
+int futex_wake(volatile int *addr, int n);
+
+/*
+ * User threads. thread_create runs func(arg) in a new thread of this
+ * process and returns its id; when func returns, the thread exits
+ * with its return value. thread_join waits for a thread to exit and
+ * collects that value. threadfork is thread_create for functions
+ * with no argument or result. Returning from main ends only the first
+ * thread; the process exits when its last thread does, with main's
+ * return value as its status. _exit (and exit) end every thread at
+ * once: blocked calls such as thread_join and futex_wait fail with
+ * EINTR. execv fails with EBUSY while there is more than one thread.
+ */
+int thread_create(void *(*func)(void *), void *arg);
+int threadfork(void (*func)(void));
+int thread_join(int tid, void **retval);
+__DEAD void thread_exit(void *retval);
+int __thread_create(void (*start)(void *, void *), void *func, void *arg);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
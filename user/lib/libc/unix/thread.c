@@ -0,0 +1,39 @@
+#include <unistd.h>
+
+/*
+ * User threads. The kernel starts a new thread at one of these start
+ * routines, passing along the two arguments given to __thread_create,
+ * and they make sure the thread exits when its function returns.
+ */
+
+static
+void
+thread_start(void *func, void *arg)
+{
+	void *(*f)(void *) = (void *(*)(void *))func;
+
+	thread_exit(f(arg));
+}
+
+static
+void
+threadfork_start(void *func, void *unused)
+{
+	void (*f)(void) = (void (*)(void))func;
+
+	(void)unused;
+	f();
+	thread_exit(NULL);
+}
+
+int
+thread_create(void *(*func)(void *), void *arg)
+{
+	return __thread_create(thread_start, (void *)func, arg);
+}
+
+int
+threadfork(void (*func)(void))
+{
+	return __thread_create(threadfork_start, (void *)func, NULL);
+}
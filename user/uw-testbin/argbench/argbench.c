@@ -0,0 +1,169 @@
+/*
+ * argbench - execv with lots of arguments.
+ *
+ *  First checks that execv fails cleanly, leaving us running, for a
+ *  nonexistent program, an argv with a bad pointer in it, and an
+ *  argument list bigger than ARG_MAX. Then execs itself ROUNDS times
+ *  in a chain, each time with NARGS arguments of assorted lengths
+ *  (about half of ARG_MAX in all); each generation checks that it
+ *  got every argument intact before going on. The last one reports
+ *  the time per exec.
+ *
+ *  relies on execv, __time, and console write
+ *
+ *  usage: argbench [rounds]
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <err.h>
+
+#define DEFAULT_ROUNDS 20
+#define NARGS 300
+#define ARGLEN 200		/* longest argument */
+#define NHDR 5			/* argv[0], rounds, rounds left, start time */
+
+static char store[NARGS][ARGLEN + 1];
+static char *xargv[NHDR + NARGS + 1];
+static char bigarg[ARGLEN + 1];
+static char *bigargv[ARG_MAX / ARGLEN + 2];
+
+/* argument i is i%26+'a', repeated; lengths vary to upset alignment */
+static
+unsigned
+arglen(int i)
+{
+  return 1 + (i * 37) % ARGLEN;
+}
+
+static
+void
+makeargs(void)
+{
+  int i;
+
+  for (i = 0; i < NARGS; i++) {
+    memset(store[i], 'a' + i % 26, arglen(i));
+    store[i][arglen(i)] = 0;
+  }
+}
+
+static
+void
+checkargs(int argc, char *argv[])
+{
+  int i;
+
+  if (argc != NHDR + NARGS) {
+    errx(1, "argc is %d, expected %d", argc, NHDR + NARGS);
+  }
+  for (i = 0; i < NARGS; i++) {
+    if (strcmp(argv[NHDR + i], store[i]) != 0) {
+      errx(1, "argument %d is wrong", NHDR + i);
+    }
+  }
+  if (argv[argc] != NULL) {
+    errx(1, "argv[argc] isn't NULL");
+  }
+}
+
+static
+void
+execfail(const char *what, const char *prog, char **args, int expected)
+{
+  int result;
+
+  result = execv(prog, args);
+  if (result != -1 || errno != expected) {
+    errx(1, "execv with %s: got %d, errno %d; expected errno %d",
+         what, result, errno, expected);
+  }
+}
+
+static
+void
+next(char *self, const char *rounds, int left, const char *s, const char *ns)
+{
+  char leftstr[16];
+  int i;
+
+  snprintf(leftstr, sizeof(leftstr), "%d", left);
+  xargv[0] = self;
+  xargv[1] = (char *)rounds;
+  xargv[2] = leftstr;
+  xargv[3] = (char *)s;
+  xargv[4] = (char *)ns;
+  for (i = 0; i < NARGS; i++) {
+    xargv[NHDR + i] = store[i];
+  }
+  xargv[NHDR + NARGS] = NULL;
+  execv(self, xargv);
+  err(1, "execv %s", self);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char roundstr[16], sstr[16], nsstr[16];
+  time_t s0, s1;
+  unsigned long ns0, ns1, us, total;
+  int rounds, left, i;
+  char *badargv[3];
+
+  makeargs();
+
+  if (argc == NHDR + NARGS) {
+    /* a later generation */
+    checkargs(argc, argv);
+    rounds = atoi(argv[1]);
+    left = atoi(argv[2]);
+    if (left > 0) {
+      next(argv[0], argv[1], left - 1, argv[3], argv[4]);
+    }
+    __time(&s1, &ns1);
+    s0 = atoi(argv[3]);
+    ns0 = atoi(argv[4]);
+    us = (unsigned long)(s1 - s0) * 1000000UL + ns1 / 1000 - ns0 / 1000;
+    total = 0;
+    for (i = 0; i < NARGS; i++) {
+      total += arglen(i) + 1;
+    }
+    printf("argbench: %d execs with %d args, %lu bytes: %lu us each\n",
+           rounds, NARGS, total, us / rounds);
+    return 0;
+  }
+
+  rounds = DEFAULT_ROUNDS;
+  if (argc > 1) {
+    rounds = atoi(argv[1]);
+  }
+  if (rounds <= 0) {
+    errx(1, "usage: argbench [rounds]");
+  }
+
+  execfail("a missing program", "/no/such/program", argv, ENOENT);
+
+  badargv[0] = argv[0];
+  badargv[1] = (char *)0x40000000;
+  badargv[2] = NULL;
+  execfail("a bad pointer", argv[0], badargv, EFAULT);
+
+  memset(bigarg, 'x', ARGLEN);
+  for (i = 0; i < ARG_MAX / ARGLEN + 1; i++) {
+    bigargv[i] = bigarg;
+  }
+  bigargv[i] = NULL;
+  execfail("too many arguments", argv[0], bigargv, E2BIG);
+
+  printf("argbench: error cases passed\n");
+
+  __time(&s0, &ns0);
+  snprintf(roundstr, sizeof(roundstr), "%d", rounds);
+  snprintf(sstr, sizeof(sstr), "%ld", (long)s0);
+  snprintf(nsstr, sizeof(nsstr), "%lu", ns0);
+  next(argv[0], roundstr, rounds - 1, sstr, nsstr);
+  return 1;
+}
@@ -0,0 +1,91 @@
+/*
+ * exitlat - how long after a child calls _exit does waitpid return?
+ *
+ *  The program has a BIGPAGES-page array, so its address space (and
+ *  each child's) is fairly large. For each round the parent picks a
+ *  deadline a little in the future and forks; the child touches the
+ *  array, spins until the deadline and calls _exit at once, while
+ *  the parent sits in waitpid. The parent reports how long after the
+ *  deadline waitpid returned. With the address space torn down in
+ *  the background, that shouldn't depend on how big the child is.
+ *
+ *  relies on fork, _exit, waitpid, __time, and console write
+ *
+ *  usage: exitlat [rounds]
+ */
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+#define BIGPAGES 128
+#define PAGESIZE 4096
+#define DEFAULT_ROUNDS 10
+#define LEADTIME_NS 200000000UL		/* deadline is this far ahead */
+
+static char big[BIGPAGES * PAGESIZE];
+
+/* nanoseconds since an arbitrary point */
+static
+unsigned long long
+now_ns(void)
+{
+  time_t s;
+  unsigned long ns;
+
+  __time(&s, &ns);
+  return (unsigned long long)s * 1000000000ULL + ns;
+}
+
+int
+main(int argc, char *argv[])
+{
+  unsigned long long deadline, back, total, worst;
+  int rounds = DEFAULT_ROUNDS;
+  int i, j, status;
+  pid_t pid;
+
+  if (argc > 1) {
+    rounds = atoi(argv[1]);
+  }
+  if (rounds <= 0) {
+    errx(1, "usage: exitlat [rounds]");
+  }
+
+  total = 0;
+  worst = 0;
+  for (i = 0; i < rounds; i++) {
+    deadline = now_ns() + LEADTIME_NS;
+    pid = fork();
+    if (pid < 0) {
+      err(1, "fork");
+    }
+    if (pid == 0) {
+      for (j = 0; j < BIGPAGES; j++) {
+        big[j * PAGESIZE] = (char)j;
+      }
+      while (now_ns() < deadline) {
+        /* spin */
+      }
+      _exit(0);
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+      err(1, "waitpid");
+    }
+    back = now_ns();
+    if (back < deadline) {
+      errx(1, "waitpid returned before the child's deadline");
+    }
+    total += back - deadline;
+    if (back - deadline > worst) {
+      worst = back - deadline;
+    }
+  }
+
+  printf("exitlat: %d pages, %d rounds: _exit to waitpid "
+         "%lu us average, %lu us worst\n", BIGPAGES, rounds,
+         (unsigned long)(total / rounds / 1000),
+         (unsigned long)(worst / 1000));
+  return 0;
+}
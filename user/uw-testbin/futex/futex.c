@@ -0,0 +1,280 @@
+/*
+ * futex - futex_wait/futex_wake and a futex-based mutex.
+ *
+ *  Checks that futex_wait returns EAGAIN at once when the word no
+ *  longer holds the expected value, that futex_wake with nobody
+ *  waiting wakes nobody, and that misaligned addresses are refused.
+ *  Then takes and releases an uncontended mutex many times; that
+ *  path never enters the kernel, so it should be about as fast as
+ *  the loop around it. Then several threads share the mutex, which
+ *  exercises the futex_wait/futex_wake slow path; no increments of
+ *  the counter it protects may be lost. Last, a child process calls
+ *  _exit while its other threads keep going in and out of futex_wait;
+ *  it must exit with its status every time rather than hang with a
+ *  thread asleep that nobody will wake.
+ *
+ *  relies on futex_wait, futex_wake, thread_create, thread_join, fork,
+ *  waitpid, _exit, __time, and console write
+ *
+ *  usage: futex [iterations]
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/wait.h>
+
+#define DEFAULT_ITERS 100000
+#define NTHREADS 4
+#define EXIT_ROUNDS 20
+#define EXIT_SPIN 20000
+
+static volatile int shared_mutex = 0;
+static volatile unsigned long shared_counter = 0;
+static int thread_iters;
+
+/*
+ * Compare and swap: if *p == old, set it to new. Returns what was in
+ * *p. If the loaded value doesn't match, the SC is skipped with y
+ * still 1 so we return instead of retrying.
+ */
+static
+int
+cas(volatile int *p, int old, int new)
+{
+  int x, y;
+
+  do {
+    __asm volatile(
+      ".set push;"
+      ".set mips32;"
+      ".set volatile;"
+      ".set noreorder;"
+      "li %1, 1;"
+      "ll %0, 0(%2);"
+      "bne %0, %3, 1f;"
+      "nop;"
+      "move %1, %4;"
+      "sc %1, 0(%2);"
+      "1:"
+      ".set pop"
+      : "=&r" (x), "=&r" (y)
+      : "r" (p), "r" (old), "r" (new)
+      : "memory");
+  } while (y == 0);
+  return x;
+}
+
+static
+int
+swap(volatile int *p, int new)
+{
+  int old;
+
+  do {
+    old = *p;
+  } while (cas(p, old, new) != old);
+  return old;
+}
+
+/*
+ * Mutex: 0 is unlocked, 1 locked, 2 locked and maybe contended.
+ * Only a 2 makes unlock call futex_wake, and only a thread that
+ * finds it locked sets 2, so the uncontended case is one CAS each
+ * way and no system calls.
+ */
+static
+void
+mutex_lock(volatile int *m)
+{
+  int c;
+
+  c = cas(m, 0, 1);
+  if (c == 0) {
+    return;
+  }
+  if (c != 2) {
+    c = swap(m, 2);
+  }
+  while (c != 0) {
+    futex_wait(m, 2);
+    c = swap(m, 2);
+  }
+}
+
+static
+void
+mutex_unlock(volatile int *m)
+{
+  if (swap(m, 0) == 2) {
+    futex_wake(m, 1);
+  }
+}
+
+static
+void *
+contender(void *arg)
+{
+  int i;
+
+  (void)arg;
+  for (i = 0; i < thread_iters; i++) {
+    mutex_lock(&shared_mutex);
+    shared_counter++;
+    mutex_unlock(&shared_mutex);
+  }
+  return NULL;
+}
+
+/* word the exit-test threads wait on and wake each other with */
+static volatile int churn = 0;
+
+static
+void *
+churn_waiter(void *arg)
+{
+  (void)arg;
+  while (1) {
+    futex_wait(&churn, 0);
+  }
+  return NULL;
+}
+
+static
+void *
+churn_waker(void *arg)
+{
+  (void)arg;
+  while (1) {
+    futex_wake(&churn, NTHREADS);
+  }
+  return NULL;
+}
+
+/*
+ * In a child: start waiters and a waker, so that at any moment some
+ * waiter is likely to be on its way into futex_wait, then _exit.
+ */
+static
+void
+exit_round(int round)
+{
+  pid_t pid;
+  int i, status;
+  volatile int spin;
+
+  pid = fork();
+  if (pid < 0) {
+    err(1, "fork");
+  }
+  if (pid == 0) {
+    for (i = 0; i < NTHREADS; i++) {
+      if (thread_create(churn_waiter, NULL) < 0) {
+        err(1, "thread_create");
+      }
+    }
+    if (thread_create(churn_waker, NULL) < 0) {
+      err(1, "thread_create");
+    }
+    for (spin = 0; spin < EXIT_SPIN * (round % 4 + 1); spin++) {
+      /* let them get going */
+    }
+    _exit(7);
+  }
+  if (waitpid(pid, &status, 0) < 0) {
+    err(1, "waitpid");
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 7) {
+    errx(1, "exit with futex waiters: round %d, status 0x%x", round,
+         status);
+  }
+}
+
+/* elapsed time in microseconds */
+static
+unsigned long
+elapsed(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+  return (unsigned long)(s1 - s0) * 1000000UL + ns1 / 1000 - ns0 / 1000;
+}
+
+int
+main(int argc, char *argv[])
+{
+  volatile int word = 5;
+  volatile int mutex = 0;
+  volatile char bytes[8];
+  volatile unsigned long counter = 0;
+  int iters = DEFAULT_ITERS;
+  int tids[NTHREADS];
+  int i, r;
+  time_t s0, s1;
+  unsigned long ns0, ns1;
+
+  if (argc > 1) {
+    iters = atoi(argv[1]);
+  }
+  if (iters <= 0) {
+    errx(1, "usage: futex [iterations]");
+  }
+
+  r = futex_wait(&word, 4);
+  if (r != -1 || errno != EAGAIN) {
+    errx(1, "futex_wait on a changed word: got %d, errno %d", r, errno);
+  }
+
+  r = futex_wake(&word, 1);
+  if (r != 0) {
+    errx(1, "futex_wake with no waiters woke %d", r);
+  }
+
+  r = futex_wake((volatile int *)(bytes + 1), 1);
+  if (r != -1 || errno != EINVAL) {
+    errx(1, "futex_wake on a misaligned address: got %d", r);
+  }
+
+  __time(&s0, &ns0);
+  for (i = 0; i < iters; i++) {
+    mutex_lock(&mutex);
+    counter++;
+    mutex_unlock(&mutex);
+  }
+  __time(&s1, &ns1);
+  if (counter != (unsigned long)iters || mutex != 0) {
+    errx(1, "mutex: counter %lu, state %d", counter, mutex);
+  }
+
+  printf("futex: %d uncontended lock/unlock pairs in %lu us\n",
+         iters, elapsed(s0, ns0, s1, ns1));
+
+  thread_iters = iters / NTHREADS;
+  __time(&s0, &ns0);
+  for (i = 0; i < NTHREADS; i++) {
+    tids[i] = thread_create(contender, NULL);
+    if (tids[i] < 0) {
+      err(1, "thread_create");
+    }
+  }
+  for (i = 0; i < NTHREADS; i++) {
+    if (thread_join(tids[i], NULL) < 0) {
+      err(1, "thread_join");
+    }
+  }
+  __time(&s1, &ns1);
+  if (shared_counter != (unsigned long)thread_iters * NTHREADS ||
+      shared_mutex != 0) {
+    errx(1, "contended mutex: counter %lu, expected %lu, state %d",
+         shared_counter, (unsigned long)thread_iters * NTHREADS,
+         shared_mutex);
+  }
+  printf("futex: %d threads x %d contended pairs in %lu us\n",
+         NTHREADS, thread_iters, elapsed(s0, ns0, s1, ns1));
+
+  for (i = 0; i < EXIT_ROUNDS; i++) {
+    exit_round(i);
+  }
+  printf("futex: %d exits with threads in futex_wait\n", EXIT_ROUNDS);
+  printf("futex test passed\n");
+  return 0;
+}
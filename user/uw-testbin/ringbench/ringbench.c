@@ -0,0 +1,150 @@
+/*
+ * ringbench - batched system calls through the system call ring.
+ *
+ *  Checks that the ring gives the same answers as ordinary calls:
+ *  getpid's pid, a write's byte count, and ENOSYS for a call that
+ *  can't be batched. Then makes the same calls many times, once with
+ *  a trap each and once through the ring RINGSIZE at a time, and
+ *  reports calls per second both ways. The writes are zero-length
+ *  ones to stdout, so what's measured is the cost of getting into and
+ *  out of the kernel rather than of the console.
+ *
+ *  relies on sysring_enter, getpid, write, __time, and console write
+ *
+ *  usage: ringbench [calls]
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sysring.h>
+#include <errno.h>
+#include <err.h>
+
+#define DEFAULT_CALLS 20000
+#define RINGSIZE 64
+
+static struct sysring_entry entries[RINGSIZE];
+static struct sysring ring = { RINGSIZE, 0, 0, entries };
+
+static
+void
+submit(int op, unsigned a0, unsigned a1, unsigned a2)
+{
+  struct sysring_entry *se;
+
+  if (ring.sr_head - ring.sr_tail == RINGSIZE) {
+    errx(1, "ring full");
+  }
+  se = &entries[ring.sr_head % RINGSIZE];
+  se->se_op = op;
+  se->se_arg[0] = a0;
+  se->se_arg[1] = a1;
+  se->se_arg[2] = a2;
+  ring.sr_head++;
+}
+
+/* run everything queued */
+static
+void
+drain(void)
+{
+  unsigned n = ring.sr_head - ring.sr_tail;
+  int r;
+
+  r = sysring_enter(&ring, n);
+  if (r < 0) {
+    err(1, "sysring_enter");
+  }
+  if ((unsigned)r != n || ring.sr_tail != ring.sr_head) {
+    errx(1, "sysring_enter did %d of %u", r, n);
+  }
+}
+
+/* elapsed time in microseconds */
+static
+unsigned long
+elapsed(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+  return (unsigned long)(s1 - s0) * 1000000UL + ns1 / 1000 - ns0 / 1000;
+}
+
+static
+void
+report(const char *what, const char *how, int calls, unsigned long us)
+{
+  if (us == 0) {
+    us = 1;
+  }
+  printf("ringbench: %-7s %-12s %d calls in %lu us, %llu calls/sec\n",
+         what, how, calls, us,
+         (unsigned long long)calls * 1000000ULL / us);
+}
+
+int
+main(int argc, char *argv[])
+{
+  static const char msg[] = "ringbench: written through the ring\n";
+  struct sysring_entry *se;
+  int calls = DEFAULT_CALLS;
+  int i, j, op;
+  time_t s0, s1;
+  unsigned long ns0, ns1;
+
+  if (argc > 1) {
+    calls = atoi(argv[1]);
+  }
+  if (calls <= 0) {
+    errx(1, "usage: ringbench [calls]");
+  }
+
+  submit(SYS_getpid, 0, 0, 0);
+  submit(SYS_write, STDOUT_FILENO, (unsigned)msg, sizeof(msg) - 1);
+  submit(SYS_fork, 0, 0, 0);
+  drain();
+  se = &entries[0];
+  if (se->se_error != 0 || se->se_result != getpid()) {
+    errx(1, "getpid: got %d, error %d", se->se_result, se->se_error);
+  }
+  se = &entries[1];
+  if (se->se_error != 0 || se->se_result != (int)sizeof(msg) - 1) {
+    errx(1, "write: got %d, error %d", se->se_result, se->se_error);
+  }
+  se = &entries[2];
+  if (se->se_error != ENOSYS || se->se_result != -1) {
+    errx(1, "fork: got %d, error %d", se->se_result, se->se_error);
+  }
+
+  for (op = 0; op < 2; op++) {
+    const char *what = op == 0 ? "getpid" : "write";
+
+    __time(&s0, &ns0);
+    for (i = 0; i < calls; i++) {
+      if (op == 0) {
+        getpid();
+      }
+      else {
+        write(STDOUT_FILENO, msg, 0);
+      }
+    }
+    __time(&s1, &ns1);
+    report(what, "one per trap", calls, elapsed(s0, ns0, s1, ns1));
+
+    __time(&s0, &ns0);
+    for (i = 0; i < calls; i += RINGSIZE) {
+      for (j = i; j < calls && j < i + RINGSIZE; j++) {
+        if (op == 0) {
+          submit(SYS_getpid, 0, 0, 0);
+        }
+        else {
+          submit(SYS_write, STDOUT_FILENO, (unsigned)msg, 0);
+        }
+      }
+      drain();
+    }
+    __time(&s1, &ns1);
+    report(what, "ring", calls, elapsed(s0, ns0, s1, ns1));
+  }
+
+  printf("ringbench test passed\n");
+  return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * schedlat - interactive latency under CPU-bound load.
+ *
+ *  parent forks several children that spin forever-ish, then
+ *  repeatedly does a short console write and measures how long each
+ *  one takes. A scheduler that favours threads that block (MLFQ)
+ *  should keep the average and worst case close to the unloaded
+ *  numbers; plain round-robin makes the parent wait behind every hog.
+ *
+ *  relies on fork, console write, __time, _exit, and waitpid
+ *
+ *  usage: schedlat [nhogs [iterations]]
+ *
+ *  Run it once after "sched rr" and once after "sched mlfq" from the
+ *  kernel menu to compare.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+#define DEFAULT_HOGS 4
+#define DEFAULT_ITERS 50
+#define MAX_HOGS 16
+#define HOG_LOOPS 20000000
+
+static
+void
+hog(void)
+{
+  volatile unsigned long x = 0;
+  unsigned long i;
+
+  for (i = 0; i < HOG_LOOPS; i++) {
+    x += i;
+  }
+  _exit(0);
+}
+
+/* elapsed time in microseconds */
+static
+unsigned long
+elapsed(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+  return (unsigned long)(s1 - s0) * 1000000UL + ns1 / 1000 - ns0 / 1000;
+}
+
+int
+main(int argc, char *argv[])
+{
+  pid_t pids[MAX_HOGS];
+  int nhogs = DEFAULT_HOGS;
+  int iters = DEFAULT_ITERS;
+  int i, status;
+  time_t s0, s1;
+  unsigned long ns0, ns1, us, total = 0, worst = 0;
+
+  if (argc > 1) {
+    nhogs = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    iters = atoi(argv[2]);
+  }
+  if (nhogs < 0 || nhogs > MAX_HOGS || iters <= 0) {
+    errx(1, "usage: schedlat [nhogs (0-%d) [iterations]]", MAX_HOGS);
+  }
+
+  for (i = 0; i < nhogs; i++) {
+    pids[i] = fork();
+    if (pids[i] < 0) {
+      errx(1, "fork %d", i);
+    }
+    if (pids[i] == 0) {
+      hog();
+    }
+  }
+
+  for (i = 0; i < iters; i++) {
+    __time(&s0, &ns0);
+    write(STDOUT_FILENO, ".", 1);
+    __time(&s1, &ns1);
+    us = elapsed(s0, ns0, s1, ns1);
+    total += us;
+    if (us > worst) {
+      worst = us;
+    }
+  }
+
+  printf("\nschedlat: %d hogs, %d writes: avg %lu us, max %lu us\n",
+         nhogs, iters, total / iters, worst);
+
+  for (i = 0; i < nhogs; i++) {
+    if (waitpid(pids[i], &status, 0) < 0) {
+      warnx("waitpid %d", i);
+    }
+  }
+  return 0;
+}
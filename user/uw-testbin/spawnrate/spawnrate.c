@@ -0,0 +1,115 @@
+/*
+ * spawnrate - how fast can we start processes?
+ *
+ *  Runs a small program (by default /bin/true) to completion over and
+ *  over, starting it each of three ways: fork then execv, vfork then
+ *  execv, and posix_spawn, and reports the time per process for each.
+ *  fork copies our whole address space only for execv to throw it
+ *  away; vfork lends it to the child instead, and posix_spawn never
+ *  involves it at all. The BIGPAGES-page array makes our address
+ *  space big enough for the difference to show.
+ *
+ *  relies on fork, vfork, execv, posix_spawn, waitpid, _exit,
+ *  __time, and console write
+ *
+ *  usage: spawnrate [rounds [program]]
+ */
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <spawn.h>
+#include <errno.h>
+#include <err.h>
+
+#define DEFAULT_ROUNDS 20
+#define DEFAULT_PROG "/bin/true"
+#define BIGPAGES 64
+
+static char big[BIGPAGES * 4096];
+
+enum method { M_FORK, M_VFORK, M_SPAWN };
+static const char *const methodnames[] = { "fork+execv", "vfork+execv",
+                                           "posix_spawn" };
+
+static
+void
+runone(enum method m, char *args[])
+{
+  pid_t pid;
+  int status, result;
+
+  switch (m) {
+  case M_FORK:
+    pid = fork();
+    if (pid < 0) {
+      err(1, "fork");
+    }
+    if (pid == 0) {
+      execv(args[0], args);
+      _exit(255);
+    }
+    break;
+  case M_VFORK:
+    pid = vfork();
+    if (pid < 0) {
+      err(1, "vfork");
+    }
+    if (pid == 0) {
+      execv(args[0], args);
+      _exit(255);
+    }
+    break;
+  default:
+    result = posix_spawn(&pid, args[0], NULL, NULL, args, NULL);
+    if (result) {
+      errno = result;
+      err(1, "posix_spawn: %s", args[0]);
+    }
+    break;
+  }
+
+  if (waitpid(pid, &status, 0) < 0) {
+    err(1, "waitpid");
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) == 255) {
+    errx(1, "%s: %s didn't run", methodnames[m], args[0]);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *args[2];
+  int rounds = DEFAULT_ROUNDS;
+  int i;
+  enum method m;
+  time_t s0, s1;
+  unsigned long ns0, ns1, us;
+
+  if (argc > 1) {
+    rounds = atoi(argv[1]);
+  }
+  if (rounds <= 0) {
+    errx(1, "usage: spawnrate [rounds [program]]");
+  }
+  args[0] = argc > 2 ? argv[2] : DEFAULT_PROG;
+  args[1] = NULL;
+
+  /* make sure it's really there for fork to copy */
+  for (i = 0; i < BIGPAGES; i++) {
+    big[i * 4096] = 1;
+  }
+
+  for (m = M_FORK; m <= M_SPAWN; m++) {
+    __time(&s0, &ns0);
+    for (i = 0; i < rounds; i++) {
+      runone(m, args);
+    }
+    __time(&s1, &ns1);
+    us = (unsigned long)(s1 - s0) * 1000000UL + ns1 / 1000 - ns0 / 1000;
+    printf("spawnrate: %-12s %d x %s: %lu us each\n",
+           methodnames[m], rounds, args[0], us / rounds);
+  }
+  return 0;
+}
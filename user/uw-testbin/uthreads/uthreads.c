@@ -0,0 +1,108 @@
+/*
+ * uthreads - user threads sharing an address space.
+ *
+ *  Starts several threads that each sum their own part of a shared
+ *  array and return the sum; joins them all and checks the total,
+ *  so each thread needs a working stack of its own and thread_join
+ *  must hand back the right values. Then checks that joining a
+ *  thread twice fails, and finally leaves one thread running when
+ *  main returns: the process should only exit once it is done, so
+ *  its message should appear before the shell prompt.
+ *
+ *  relies on thread_create, thread_join, thread_exit, and console write
+ *
+ *  usage: uthreads [nthreads]
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define DEFAULT_THREADS 8
+#define MAX_THREADS 16
+#define NVALUES 4096
+#define STRAGGLER_LOOPS 2000000
+
+static int values[NVALUES];
+static int nthreads = DEFAULT_THREADS;
+
+static
+void *
+summer(void *arg)
+{
+  int me = (int)arg;
+  int i, from, to;
+  long sum = 0;
+
+  from = NVALUES * me / nthreads;
+  to = NVALUES * (me + 1) / nthreads;
+  for (i = from; i < to; i++) {
+    sum += values[i];
+  }
+  return (void *)sum;
+}
+
+static
+void
+straggler(void)
+{
+  volatile unsigned long x = 0;
+  unsigned long i;
+
+  for (i = 0; i < STRAGGLER_LOOPS; i++) {
+    x += i;
+  }
+  printf("uthreads: straggler done, process may now exit\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int tids[MAX_THREADS];
+  int i, r;
+  void *ret;
+  long total = 0, expected = 0;
+
+  if (argc > 1) {
+    nthreads = atoi(argv[1]);
+  }
+  if (nthreads <= 0 || nthreads > MAX_THREADS) {
+    errx(1, "usage: uthreads [nthreads (1-%d)]", MAX_THREADS);
+  }
+
+  for (i = 0; i < NVALUES; i++) {
+    values[i] = i;
+    expected += i;
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    tids[i] = thread_create(summer, (void *)i);
+    if (tids[i] < 0) {
+      err(1, "thread_create %d", i);
+    }
+  }
+  for (i = 0; i < nthreads; i++) {
+    if (thread_join(tids[i], &ret) < 0) {
+      err(1, "thread_join %d", i);
+    }
+    total += (long)ret;
+  }
+  if (total != expected) {
+    errx(1, "threads summed to %ld, expected %ld", total, expected);
+  }
+
+  r = thread_join(tids[0], &ret);
+  if (r != -1 || errno != ESRCH) {
+    errx(1, "second thread_join of the same thread: got %d", r);
+  }
+
+  printf("uthreads: %d threads summed %d values correctly\n",
+         nthreads, NVALUES);
+
+  if (threadfork(straggler) < 0) {
+    err(1, "threadfork");
+  }
+  printf("uthreads: main returning\n");
+  return 0;
+}
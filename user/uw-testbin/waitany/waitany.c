@@ -0,0 +1,106 @@
+/*
+ * waitany - waitpid(-1) and WNOHANG.
+ *
+ *  The parent forks NCHILDREN children, which spin for a while (the
+ *  later ones longer) and exit with distinct codes. It polls with
+ *  WNOHANG, which must return 0 or a child's pid, then collects the
+ *  rest with waitpid(-1). Every child must be collected exactly once
+ *  with its own exit code, after which waitpid(-1) must fail with
+ *  ECHILD, as must waiting for a pid that isn't our child.
+ *
+ *  relies on fork, _exit, waitpid, getpid, and console write
+ *
+ *  usage: waitany
+ */
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NCHILDREN 8
+#define SPIN 20000
+
+static pid_t pids[NCHILDREN];
+static int collected[NCHILDREN];
+
+static
+void
+collect(pid_t pid, int status)
+{
+  int i;
+
+  for (i = 0; i < NCHILDREN; i++) {
+    if (pids[i] == pid) {
+      break;
+    }
+  }
+  if (i == NCHILDREN) {
+    errx(1, "waitpid returned %d, which isn't our child", pid);
+  }
+  if (collected[i]) {
+    errx(1, "child %d collected twice", pid);
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != i + 1) {
+    errx(1, "child %d: status %d, expected exit %d", pid, status, i + 1);
+  }
+  collected[i] = 1;
+}
+
+int
+main(void)
+{
+  volatile int spin;
+  int i, status, ncollected, npolls;
+  pid_t pid;
+
+  for (i = 0; i < NCHILDREN; i++) {
+    pids[i] = fork();
+    if (pids[i] < 0) {
+      err(1, "fork");
+    }
+    if (pids[i] == 0) {
+      for (spin = 0; spin < SPIN * (i + 1); spin++) {
+        /* nothing */
+      }
+      _exit(i + 1);
+    }
+  }
+
+  ncollected = 0;
+  npolls = 0;
+  while (ncollected < NCHILDREN / 2) {
+    pid = waitpid(-1, &status, WNOHANG);
+    if (pid < 0) {
+      err(1, "waitpid(-1, WNOHANG)");
+    }
+    npolls++;
+    if (pid > 0) {
+      collect(pid, status);
+      ncollected++;
+    }
+  }
+  while (ncollected < NCHILDREN) {
+    pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      err(1, "waitpid(-1)");
+    }
+    collect(pid, status);
+    ncollected++;
+  }
+
+  if (waitpid(-1, &status, 0) >= 0 || errno != ECHILD) {
+    errx(1, "waitpid(-1) with no children didn't fail with ECHILD");
+  }
+  if (waitpid(-1, &status, WNOHANG) >= 0 || errno != ECHILD) {
+    errx(1, "waitpid(-1, WNOHANG) with no children didn't fail with ECHILD");
+  }
+  if (waitpid(getpid(), &status, 0) >= 0 || errno != ECHILD) {
+    errx(1, "waitpid on ourselves didn't fail with ECHILD");
+  }
+
+  printf("waitany: collected %d children (%d WNOHANG polls)\n",
+         NCHILDREN, npolls);
+  printf("waitany test passed\n");
+  return 0;
+}